@@ -0,0 +1,346 @@
+#include "benchmark.h"
+#include "voice_store.h"
+#include "voice_queue.h"
+#include "led_effects.h"
+#include "led_framebuffer.h"
+#include "metrics.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "benchmark";
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_MAX_SIZES 8
+#define BENCH_LED_MAX 2048
+#define BENCH_CHANNELS 16
+#define BENCH_USER_BASE 100000000000000000ULL    // snowflake-sized ids
+#define BENCH_CHANNEL_BASE 200000000000000000ULL
+#define BENCH_GUILD 300000000000000000ULL
+
+typedef struct {
+    const char *name;
+    uint32_t size;      // users or LEDs
+    uint32_t ops;       // events or frames
+    uint32_t rejected;  // users the store had no room for
+    int64_t us;
+    uint32_t cycles;    // wraps after ~17 s at 240 MHz, far beyond any case
+    int32_t heap_delta; // free heap after minus before, negative is a leak
+} bench_result_t;
+
+// Timing of the case in progress
+typedef struct {
+    int64_t start_us;
+    uint32_t start_cycles;
+    size_t start_heap;
+} bench_timer_t;
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static size_t result_count = 0;
+
+static voice_queue_t queue;
+static led_rgb_t frame[BENCH_LED_MAX];
+static led_rgb_t from[BENCH_LED_MAX];
+static uint32_t rng_state = 0x12345678;
+
+
+// ======= Helpers =======
+
+// xorshift32, fixed seed so every firmware version sees the same load
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Parse "10,100,1000" into at most max values
+static size_t parse_sizes(const char *list, uint32_t *out, size_t max)
+{
+    size_t count = 0;
+    const char *p = list;
+    while (*p && count < max) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p) break;
+        if (value > 0) out[count++] = (uint32_t)value;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+static void timer_start(bench_timer_t *timer)
+{
+    timer->start_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    timer->start_cycles = esp_cpu_get_cycle_count();
+    timer->start_us = esp_timer_get_time();
+}
+
+static bench_result_t *timer_stop(const bench_timer_t *timer, const char *name, uint32_t size, uint32_t ops)
+{
+    int64_t end_us = esp_timer_get_time();
+    uint32_t end_cycles = esp_cpu_get_cycle_count();
+    size_t end_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    // Let IDLE run between cases, the whole run would trip the task
+    // watchdog otherwise. Outside the timed section.
+    vTaskDelay(1);
+
+    if (result_count == BENCH_MAX_RESULTS) return NULL;
+    bench_result_t *result = &results[result_count++];
+    *result = (bench_result_t){
+        .name = name,
+        .size = size,
+        .ops = ops,
+        .us = end_us - timer->start_us,
+        .cycles = end_cycles - timer->start_cycles,
+        .heap_delta = (int32_t)end_heap - (int32_t)timer->start_heap,
+    };
+    return result;
+}
+
+static uint64_t bench_user(uint32_t index)
+{
+    return BENCH_USER_BASE + index;
+}
+
+static uint64_t bench_channel(uint32_t index)
+{
+    return BENCH_CHANNEL_BASE + index % BENCH_CHANNELS;
+}
+
+
+// ======= Voice state =======
+
+// Pop everything queued and apply it, like the voice task does
+static uint32_t drain_queue(void)
+{
+    voice_delta_t delta;
+    uint32_t rejected = 0;
+    while (voice_queue_pop(&queue, &delta)) {
+        if (voice_store_update(0, delta.guild_id, delta.user_id, delta.channel_id) == VOICE_STORE_FULL) rejected++;
+    }
+    return rejected;
+}
+
+// Every user shows up at once, as after GUILD_CREATE, into a fresh snapshot
+static void bench_voice_burst(uint32_t users)
+{
+    bench_timer_t timer;
+    uint32_t rejected = 0;
+
+    voice_queue_init(&queue);
+    timer_start(&timer);
+    voice_store_snapshot_begin(0);
+    for (uint32_t i = 0; i < users; i++) {
+        voice_delta_t delta = {
+            .guild_id = BENCH_GUILD,
+            .user_id = bench_user(i),
+            .channel_id = bench_channel(i),
+            .stamp_us = (uint32_t)esp_timer_get_time(),
+        };
+        // A full ring is drained right away instead of dropping deltas
+        while (!voice_queue_push(&queue, &delta)) {
+            rejected += drain_queue();
+        }
+    }
+    rejected += drain_queue();
+    voice_store_snapshot_commit();
+
+    bench_result_t *result = timer_stop(&timer, "voice_burst", users, users);
+    if (result) result->rejected = rejected;
+}
+
+// Random moves, leaves and joins among the users of the last burst plus a
+// quarter more that start out of voice
+static void bench_voice_churn(uint32_t users)
+{
+    bench_timer_t timer;
+    uint32_t rejected = 0;
+    uint32_t population = users + users / 4 + 1;
+
+    timer_start(&timer);
+    for (uint32_t i = 0; i < CONFIG_BENCHMARK_CHURN_EVENTS; i++) {
+        uint32_t r = rng_next();
+        uint64_t channel_id = (r & 7) == 0 ? 0 : bench_channel(r >> 3);
+        if (voice_store_update(0, BENCH_GUILD, bench_user(r % population), channel_id) == VOICE_STORE_FULL) rejected++;
+    }
+
+    bench_result_t *result = timer_stop(&timer, "voice_churn", users, CONFIG_BENCHMARK_CHURN_EVENTS);
+    if (result) result->rejected = rejected;
+}
+
+// Occupancy reads, as done by the LED segments every frame
+static void bench_voice_reads(uint32_t users)
+{
+    bench_timer_t timer;
+    volatile size_t sink = 0;
+
+    timer_start(&timer);
+    for (uint32_t i = 0; i < CONFIG_BENCHMARK_CHURN_EVENTS; i++) {
+        sink += voice_store_channel_count(bench_channel(i));
+    }
+    timer_stop(&timer, "voice_reads", users, CONFIG_BENCHMARK_CHURN_EVENTS);
+    (void)sink;
+}
+
+
+// ======= LED pipeline =======
+
+static void bench_effect(led_animation_type_t type, uint32_t count)
+{
+    const led_effect_t *effect = led_effect_get(type);
+    led_effect_params_t params = effect->params;
+    params.color = (led_rgb_t){ 0x23, 0xA5, 0x5A };
+    params.level = count / 2;
+    params.level_max = count;
+    if (effect->init) effect->init(&params);
+
+    bench_timer_t timer;
+    timer_start(&timer);
+    for (uint32_t i = 0; i < CONFIG_BENCHMARK_FRAMES; i++) {
+        effect->render(frame, count, i * 16, &params);
+    }
+    timer_stop(&timer, effect->name, count, CONFIG_BENCHMARK_FRAMES);
+}
+
+static void bench_blend(uint32_t count)
+{
+    led_framebuffer_fill(from, count, (led_rgb_t){ 0x80, 0x00, 0x00 });
+
+    bench_timer_t timer;
+    timer_start(&timer);
+    for (uint32_t i = 0; i < CONFIG_BENCHMARK_FRAMES; i++) {
+        led_framebuffer_blend(frame, from, count, LED_TRANSITION_FADE, (uint8_t)i);
+    }
+    timer_stop(&timer, "blend_fade", count, CONFIG_BENCHMARK_FRAMES);
+}
+
+
+// ======= Portal =======
+
+static esp_err_t discard_write(void *ctx, const char *text, size_t len)
+{
+    *(size_t *)ctx += len;
+    return ESP_OK;
+}
+
+// Everything a /metrics request does except the socket writes
+static void bench_metrics_render(void)
+{
+    size_t bytes = 0;
+    uint32_t runs = 100;
+
+    bench_timer_t timer;
+    timer_start(&timer);
+    for (uint32_t i = 0; i < runs; i++) {
+        metrics_render(discard_write, &bytes);
+    }
+    timer_stop(&timer, "metrics_render", bytes / runs, runs);
+}
+
+
+// ======= Reporting =======
+
+static uint32_t ns_per_op(const bench_result_t *result)
+{
+    return result->ops ? (uint32_t)(result->us * 1000 / result->ops) : 0;
+}
+
+static void print_results(void)
+{
+    ESP_LOGI(TAG, "%-16s %6s %8s %10s %10s %10s %8s %8s",
+             "case", "size", "ops", "total us", "ns/op", "cycles/op", "rejected", "heap");
+    for (size_t i = 0; i < result_count; i++) {
+        const bench_result_t *r = &results[i];
+        ESP_LOGI(TAG, "%-16s %6lu %8lu %10lld %10lu %10lu %8lu %8ld",
+                 r->name, (unsigned long)r->size, (unsigned long)r->ops, (long long)r->us,
+                 (unsigned long)ns_per_op(r), (unsigned long)(r->ops ? r->cycles / r->ops : 0),
+                 (unsigned long)r->rejected, (long)r->heap_delta);
+    }
+}
+
+static esp_err_t write_line(metrics_write_fn_t write, void *ctx, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static esp_err_t write_line(metrics_write_fn_t write, void *ctx, const char *fmt, ...)
+{
+    char line[160];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len < 0) return ESP_FAIL;
+    return write(ctx, line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+// One gauge family per column, labelled by case and size
+static esp_err_t collect_results(metrics_write_fn_t write, void *ctx)
+{
+    static const char *const families[] = {
+        "benchmark_ns_per_op", "benchmark_cycles_per_op", "benchmark_rejected", "benchmark_heap_delta_bytes",
+    };
+
+    esp_err_t err = ESP_OK;
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]) && err == ESP_OK; f++) {
+        err = write_line(write, ctx, "# TYPE %s gauge\n", families[f]);
+        for (size_t i = 0; i < result_count && err == ESP_OK; i++) {
+            const bench_result_t *r = &results[i];
+            long value = f == 0 ? (long)ns_per_op(r)
+                       : f == 1 ? (long)(r->ops ? r->cycles / r->ops : 0)
+                       : f == 2 ? (long)r->rejected
+                                : (long)r->heap_delta;
+            err = write_line(write, ctx, "%s{case=\"%s\",size=\"%lu\"} %ld\n",
+                             families[f], r->name, (unsigned long)r->size, value);
+        }
+    }
+    return err;
+}
+
+
+// ======= Public API =======
+
+void benchmark_run(void)
+{
+    uint32_t sizes[BENCH_MAX_SIZES];
+    size_t size_count;
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    ESP_LOGI(TAG, "Running benchmarks, this takes a few seconds");
+    result_count = 0;
+
+    size_count = parse_sizes(CONFIG_BENCHMARK_USER_COUNTS, sizes, BENCH_MAX_SIZES);
+    for (size_t i = 0; i < size_count; i++) {
+        bench_voice_burst(sizes[i]);
+        bench_voice_churn(sizes[i]);
+        bench_voice_reads(sizes[i]);
+    }
+    // Leave an empty store behind for the real session
+    voice_store_init();
+
+    size_count = parse_sizes(CONFIG_BENCHMARK_LED_COUNTS, sizes, BENCH_MAX_SIZES);
+    for (size_t i = 0; i < size_count; i++) {
+        uint32_t count = sizes[i] < BENCH_LED_MAX ? sizes[i] : BENCH_LED_MAX;
+        for (int type = 0; type < LED_ANIM_COUNT; type++) {
+            bench_effect((led_animation_type_t)type, count);
+        }
+        bench_blend(count);
+    }
+
+    bench_metrics_render();
+
+    print_results();
+    ESP_LOGI(TAG, "Done, free heap %u bytes (%+ld), minimum ever %u bytes",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+             (long)((int32_t)heap_caps_get_free_size(MALLOC_CAP_8BIT) - (int32_t)heap_before),
+             (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    metrics_register_collector(collect_results);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Run all benchmarks on the calling task and publish the results
+ *
+ * Uses the voice state store and leaves it empty, so call it before
+ * anything else feeds the store. Takes a few seconds.
+ */
+void benchmark_run(void);
+
+#ifdef __cplusplus
+}
+#endif
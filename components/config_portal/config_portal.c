@@ -4,27 +4,40 @@
 #include "esp_log.h"
 #include "ctype.h"
 #include "string.h"
+#include "strings.h"
+#include "stdlib.h"
+#include "inttypes.h"
+#include "sys/param.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_http_server.h"
+#include "stdatomic.h"
+#include "metrics.h"
+
+#include "index_html_etag.h"
+#include "style_css_etag.h"
 
 static const char* TAG = "config_portal";
 
 
 // ======= Forward declarations =======
 static esp_err_t index_get_handler(httpd_req_t *req);
-static esp_err_t css_get_handler(httpd_req_t *req);
+static esp_err_t static_asset_get_handler(httpd_req_t *req);
 static esp_err_t save_post_handler(httpd_req_t *req);
+static esp_err_t metrics_get_handler(httpd_req_t *req);
+static void ws_init(void);
+#if CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t ws_handler(httpd_req_t *req);
+#endif
 
 
 // Public API
 void config_portal_init(void);
 httpd_handle_t config_portal_start(void);
 void config_portal_stop(httpd_handle_t server);
-
-
-// Defaults
-#define DEFAULT_COLOR "#23A55A"
+esp_err_t config_portal_publish(const char *json, bool retain);
+bool config_portal_has_listeners(void);
 
 
 // Helper stuff
@@ -52,6 +65,200 @@ static void url_decode(char *dst, const char *src) {
 }
 
 
+// ======= Embedded assets =======
+extern const unsigned char _binary_index_html_start[];
+extern const unsigned char _binary_index_html_end[];
+extern const unsigned char _binary_style_css_start[];
+extern const unsigned char _binary_style_css_end[];
+extern const unsigned char _binary_style_css_gz_start[];
+extern const unsigned char _binary_style_css_gz_end[];
+
+// Static asset served as is, or pre-compressed if the client accepts gzip
+typedef struct {
+    const char *type;
+    const unsigned char *start;
+    const unsigned char *end;
+    const unsigned char *gz_start;
+    const unsigned char *gz_end;
+    const char *etag;
+    const char *gz_etag; // the encodings are different representations
+    const char *cache_control;
+} static_asset_t;
+
+static const static_asset_t style_css_asset = {
+    .type = "text/css",
+    .start = _binary_style_css_start,
+    .end = _binary_style_css_end,
+    .gz_start = _binary_style_css_gz_start,
+    .gz_end = _binary_style_css_gz_end,
+    .etag = STYLE_CSS_ETAG,
+    .gz_etag = STYLE_CSS_GZ_ETAG,
+    .cache_control = "public, max-age=300",
+};
+
+
+// ======= Template renderer =======
+
+// Placeholders are recorded once at startup, rendering then only walks this
+// table and sends the literal parts of the template straight from flash.
+#define MAX_PLACEHOLDERS 16
+#define MAX_PLACEHOLDER_KEY 24
+
+typedef struct {
+    size_t offset;                 // start of "{{" in the template
+    size_t length;                 // length of "{{KEY}}"
+    char key[MAX_PLACEHOLDER_KEY]; // settings key, lowercased
+} template_slot_t;
+
+typedef struct {
+    const char *data;
+    size_t size;
+    template_slot_t slots[MAX_PLACEHOLDERS];
+    int slot_count;
+} template_t;
+
+static template_t index_template;
+
+static void template_scan(template_t *tpl, const unsigned char *start, const unsigned char *end) {
+    tpl->data = (const char *)start;
+    tpl->size = end - start;
+    tpl->slot_count = 0;
+
+    size_t i = 0;
+    while (i + 4 <= tpl->size) {
+        if (tpl->data[i] != '{' || tpl->data[i + 1] != '{') {
+            i++;
+            continue;
+        }
+
+        // Find the closing braces, keys are short identifiers
+        size_t key_start = i + 2;
+        size_t j = key_start;
+        while (j < tpl->size && j - key_start < MAX_PLACEHOLDER_KEY &&
+               (isalnum((unsigned char)tpl->data[j]) || tpl->data[j] == '_')) {
+            j++;
+        }
+        if (j == key_start || j + 1 >= tpl->size || tpl->data[j] != '}' || tpl->data[j + 1] != '}' ||
+            j - key_start >= MAX_PLACEHOLDER_KEY) {
+            i++;
+            continue;
+        }
+
+        if (tpl->slot_count == MAX_PLACEHOLDERS) {
+            ESP_LOGW(TAG, "Too many template placeholders, ignoring the rest");
+            return;
+        }
+
+        template_slot_t *slot = &tpl->slots[tpl->slot_count++];
+        slot->offset = i;
+        slot->length = j + 2 - i;
+        for (size_t k = 0; k < j - key_start; k++) {
+            slot->key[k] = tolower((unsigned char)tpl->data[key_start + k]);
+        }
+        slot->key[j - key_start] = '\0';
+        i = j + 2;
+    }
+}
+
+// Send a value with the characters that matter in HTML escaped
+static esp_err_t send_escaped_chunk(httpd_req_t *req, const char *value) {
+    char out[64];
+    size_t n = 0;
+
+    for (const char *p = value; *p; p++) {
+        const char *esc = NULL;
+        switch (*p) {
+            case '&': esc = "&amp;"; break;
+            case '<': esc = "&lt;"; break;
+            case '>': esc = "&gt;"; break;
+            case '"': esc = "&quot;"; break;
+            case '\'': esc = "&#39;"; break;
+        }
+        size_t len = esc ? strlen(esc) : 1;
+        if (n + len > sizeof(out)) {
+            esp_err_t err = httpd_resp_send_chunk(req, out, n);
+            if (err != ESP_OK) return err;
+            n = 0;
+        }
+        if (esc) {
+            memcpy(out + n, esc, len);
+        } else {
+            out[n] = *p;
+        }
+        n += len;
+    }
+    return n ? httpd_resp_send_chunk(req, out, n) : ESP_OK;
+}
+
+// Send a value as the inside of a JSON string
+static esp_err_t send_json_chunk(httpd_req_t *req, const char *value) {
+    char out[64];
+    size_t n = 0;
+
+    for (const char *p = value; *p; p++) {
+        unsigned char c = *p;
+        char esc[8];
+        size_t len;
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = c;
+            len = 2;
+        } else if (c < 0x20) {
+            len = snprintf(esc, sizeof(esc), "\\u%04x", c);
+        } else {
+            esc[0] = c;
+            len = 1;
+        }
+        if (n + len > sizeof(out)) {
+            esp_err_t err = httpd_resp_send_chunk(req, out, n);
+            if (err != ESP_OK) return err;
+            n = 0;
+        }
+        memcpy(out + n, esc, len);
+        n += len;
+    }
+    return n ? httpd_resp_send_chunk(req, out, n) : ESP_OK;
+}
+
+// FNV-1a over every substituted value, changes whenever the output would
+static uint32_t template_values_hash(const template_t *tpl, const settings_t *settings) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < tpl->slot_count; i++) {
+        char value[SETTINGS_VALUE_MAX];
+        if (settings_format(settings, tpl->slots[i].key, value, sizeof(value)) != ESP_OK) {
+            value[0] = '\0';
+        }
+        for (const char *p = value; ; p++) {
+            hash = (hash ^ (uint8_t)*p) * 16777619u; // includes the terminator
+            if (!*p) break;
+        }
+    }
+    return hash;
+}
+
+static esp_err_t template_render(httpd_req_t *req, const template_t *tpl, const settings_t *settings) {
+    size_t pos = 0;
+    for (int i = 0; i < tpl->slot_count; i++) {
+        const template_slot_t *slot = &tpl->slots[i];
+
+        esp_err_t err = httpd_resp_send_chunk(req, tpl->data + pos, slot->offset - pos);
+        if (err != ESP_OK) return err;
+
+        char value[SETTINGS_VALUE_MAX];
+        if (settings_format(settings, slot->key, value, sizeof(value)) == ESP_OK) {
+            err = send_escaped_chunk(req, value);
+            if (err != ESP_OK) return err;
+        }
+        pos = slot->offset + slot->length;
+    }
+
+    esp_err_t err = httpd_resp_send_chunk(req, tpl->data + pos, tpl->size - pos);
+    if (err != ESP_OK) return err;
+    return httpd_resp_send_chunk(req, NULL, 0); // end of response
+}
+
+
 // ======= Initialization =======
 
 void config_portal_init(void) {
@@ -60,115 +267,378 @@ void config_portal_init(void) {
         nvs_flash_erase();
         nvs_flash_init();
     }
-    ESP_LOGI(TAG, "Config portal module initialized");
-}
+    ESP_ERROR_CHECK(settings_init());
+    ws_init();
 
-// ================= NVS =================
-esp_err_t save_setting(const char* key, const char* value) {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open("config", NVS_READWRITE, &handle);
-    if (err != ESP_OK) return err;
+    template_scan(&index_template, _binary_index_html_start, _binary_index_html_end);
+    ESP_LOGI(TAG, "Config portal module initialized (%d template placeholders)",
+             index_template.slot_count);
+}
 
-    err = nvs_set_str(handle, key, value);
-    if (err == ESP_OK) nvs_commit(handle);
-    nvs_close(handle);
+// ======= HTTP handlers =======
 
-    ESP_LOGI(TAG, "Saved key='%s', value='%s'", key, value);
-    return err;
+// True if the request header contains the given token
+static bool header_contains(httpd_req_t *req, const char *header, const char *token) {
+    char buf[128];
+    if (httpd_req_get_hdr_value_str(req, header, buf, sizeof(buf)) != ESP_OK) return false;
+    return strstr(buf, token) != NULL;
 }
 
-esp_err_t load_setting(const char* key, char* value, size_t max_len) {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open("config", NVS_READONLY, &handle);
-    if (err != ESP_OK) return err;
+// True if Accept-Encoding allows gzip. An explicit "gzip" entry decides,
+// otherwise "*" does; either is refused with q=0.
+static bool accepts_gzip(httpd_req_t *req) {
+    char buf[128];
+    if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", buf, sizeof(buf)) != ESP_OK) return false;
+
+    bool any = false;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ' || *tok == '\t') tok++;
+        char *params = strchr(tok, ';');
+        size_t len = params ? (size_t)(params - tok) : strlen(tok);
+        while (len > 0 && (tok[len - 1] == ' ' || tok[len - 1] == '\t')) len--;
+
+        const char *q = params ? strstr(params, "q=") : NULL;
+        bool allowed = !q || strtof(q + 2, NULL) > 0;
+
+        if (len == 4 && strncasecmp(tok, "gzip", 4) == 0) return allowed;
+        if (len == 1 && tok[0] == '*') any = allowed;
+    }
+    return any;
+}
 
-    err = nvs_get_str(handle, key, value, &max_len);
-    nvs_close(handle);
-    return err;
+static esp_err_t send_not_modified(httpd_req_t *req, const char *etag, const char *cache_control) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", cache_control);
+    return httpd_resp_send(req, NULL, 0);
 }
 
+static esp_err_t index_get_handler(httpd_req_t *req) {
+    // Static for the same reason as in save_post_handler()
+    static settings_t settings;
+    settings_get(&settings);
 
-// ======= Embedded assets =======
-extern const unsigned char _binary_index_html_start[];
-extern const unsigned char _binary_index_html_end[];
-extern const unsigned char _binary_style_css_start[];
-extern const unsigned char _binary_style_css_end[];
+    // The page changes with the template and with the values put into it
+    char etag[40];
+    snprintf(etag, sizeof(etag), "\"%s-%08" PRIx32 "\"",
+             INDEX_HTML_HASH, template_values_hash(&index_template, &settings));
 
-// ======= HTTP handlers =======
-static esp_err_t index_get_handler(httpd_req_t *req) {
-    char led_color[8] = DEFAULT_COLOR;
-
-    // Try to load from NVS
-    load_setting("led_color", led_color, sizeof(led_color));
-
-    // Generate HTML dynamically from template
-    char buf[1024]; // big enough for simple template
-    const char *template = (const char *)_binary_index_html_start;
-
-    // Replace {{LED_COLOR}} placeholder
-    const char *placeholder = "{{LED_COLOR}}";
-    char *pos = strstr(template, placeholder);
-    if (pos) {
-        size_t placeholder_len = strlen(placeholder);
-        size_t prefix_len = pos - template;
-        size_t suffix_len = strlen(pos + placeholder_len);
-
-        // Build final HTML into buf
-        memcpy(buf, template, prefix_len);
-        memcpy(buf + prefix_len, led_color, strlen(led_color));
-        memcpy(buf + prefix_len + strlen(led_color), pos + placeholder_len, suffix_len + 1); // +1 for null
-    } else {
-        strncpy(buf, template, sizeof(buf));
-        buf[sizeof(buf)-1] = '\0';
+    if (header_contains(req, "If-None-Match", etag)) {
+        return send_not_modified(req, etag, "no-cache");
     }
 
     httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, buf, strlen(buf));
-    return ESP_OK;
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return template_render(req, &index_template, &settings);
 }
 
 
-static esp_err_t css_get_handler(httpd_req_t *req) {
-    httpd_resp_set_type(req, "text/css");
-    httpd_resp_send(
-        req,
-        (const char *)_binary_style_css_start,
-        _binary_style_css_end - _binary_style_css_start
-    );
-    return ESP_OK;
+static esp_err_t static_asset_get_handler(httpd_req_t *req) {
+    const static_asset_t *asset = req->user_ctx;
+
+    // Pick the variant first, the validator has to match what is served
+    bool gzip = accepts_gzip(req);
+    const char *etag = gzip ? asset->gz_etag : asset->etag;
+
+    if (header_contains(req, "If-None-Match", etag)) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        return send_not_modified(req, etag, asset->cache_control);
+    }
+
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    if (gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        return httpd_resp_send(req, (const char *)asset->gz_start, asset->gz_end - asset->gz_start);
+    }
+    return httpd_resp_send(req, (const char *)asset->start, asset->end - asset->start);
+}
+
+
+// ======= WebSocket push =======
+// Messages are copied once into a slot and the httpd task sends that same
+// buffer to every /ws client, so the cost of a change does not depend on
+// how many dashboards are watching. Slots are static, a burst that fills
+// them all is dropped rather than queued on the heap.
+
+#if CONFIG_HTTPD_WS_SUPPORT
+
+#define WS_MSG_SLOTS 8
+#define WS_MSG_MAX 256
+#define WS_MAX_CLIENTS CONFIG_LWIP_MAX_SOCKETS
+
+typedef struct {
+    atomic_bool busy;
+    size_t len;
+    char data[WS_MSG_MAX];
+} ws_msg_t;
+
+static ws_msg_t ws_msgs[WS_MSG_SLOTS];
+static httpd_handle_t ws_server = NULL;
+static atomic_int ws_client_count = 0;
+static atomic_uint ws_dropped = 0;
+
+// Last retained message, sent to clients as soon as they connect
+static char ws_retained[WS_MSG_MAX];
+static size_t ws_retained_len = 0;
+static SemaphoreHandle_t ws_retained_lock = NULL;
+static StaticSemaphore_t ws_retained_lock_buf;
+
+static void ws_init(void) {
+    if (!ws_retained_lock) {
+        ws_retained_lock = xSemaphoreCreateMutexStatic(&ws_retained_lock_buf);
+    }
+}
+
+static esp_err_t ws_send_text(httpd_handle_t hd, int fd, const char *data, size_t len) {
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)data,
+        .len = len,
+    };
+    return httpd_ws_send_frame_async(hd, fd, &frame);
+}
+
+// Runs on the httpd task
+static void ws_broadcast_work(void *arg) {
+    ws_msg_t *msg = (ws_msg_t *)arg;
+    httpd_handle_t hd = ws_server;
+    int fds[WS_MAX_CLIENTS];
+    size_t fd_count = WS_MAX_CLIENTS;
+
+    if (hd && httpd_get_client_list(hd, &fd_count, fds) == ESP_OK) {
+        int clients = 0;
+        for (size_t i = 0; i < fd_count; i++) {
+            if (httpd_ws_get_fd_info(hd, fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET) continue;
+            // A failed send closes that socket, the others are not affected
+            ws_send_text(hd, fds[i], msg->data, msg->len);
+            clients++;
+        }
+        // Recounted on every push so closed clients drop out on their own
+        atomic_store(&ws_client_count, clients);
+    }
+    atomic_store(&msg->busy, false);
+}
+
+// Runs on the httpd task, right after the handshake
+static void ws_hello_work(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    httpd_handle_t hd = ws_server;
+    char buf[WS_MSG_MAX];
+    size_t len;
+
+    // Copied out so a slow client never holds up the publisher
+    xSemaphoreTake(ws_retained_lock, portMAX_DELAY);
+    len = ws_retained_len;
+    memcpy(buf, ws_retained, len);
+    xSemaphoreGive(ws_retained_lock);
+
+    if (hd && len > 0 && httpd_ws_get_fd_info(hd, fd) == HTTPD_WS_CLIENT_WEBSOCKET) {
+        ws_send_text(hd, fd, buf, len);
+    }
+}
+
+static esp_err_t ws_handler(httpd_req_t *req) {
+    if (req->method == HTTP_GET) {
+        ESP_LOGI(TAG, "WebSocket client connected (fd=%d)", httpd_req_to_sockfd(req));
+        atomic_fetch_add(&ws_client_count, 1);
+        httpd_queue_work(req->handle, ws_hello_work, (void *)(intptr_t)httpd_req_to_sockfd(req));
+        return ESP_OK;
+    }
+
+    // The stream is one way, incoming frames are read and ignored
+    uint8_t buf[128];
+    httpd_ws_frame_t frame = { .payload = buf };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) return err;
+    if (frame.len > sizeof(buf)) return ESP_ERR_INVALID_SIZE;
+    return frame.len ? httpd_ws_recv_frame(req, &frame, frame.len) : ESP_OK;
+}
+
+esp_err_t config_portal_publish(const char *json, bool retain) {
+    size_t len = strlen(json);
+    if (len > WS_MSG_MAX) return ESP_ERR_INVALID_SIZE;
+
+    if (retain) {
+        xSemaphoreTake(ws_retained_lock, portMAX_DELAY);
+        memcpy(ws_retained, json, len);
+        ws_retained_len = len;
+        xSemaphoreGive(ws_retained_lock);
+    }
+
+    httpd_handle_t hd = ws_server;
+    if (!hd || atomic_load(&ws_client_count) == 0) return ESP_OK;
+
+    for (int i = 0; i < WS_MSG_SLOTS; i++) {
+        bool expected = false;
+        if (!atomic_compare_exchange_strong(&ws_msgs[i].busy, &expected, true)) continue;
+
+        memcpy(ws_msgs[i].data, json, len);
+        ws_msgs[i].len = len;
+        esp_err_t err = httpd_queue_work(hd, ws_broadcast_work, &ws_msgs[i]);
+        if (err != ESP_OK) atomic_store(&ws_msgs[i].busy, false);
+        return err;
+    }
+
+    unsigned dropped = atomic_fetch_add(&ws_dropped, 1) + 1;
+    ESP_LOGW(TAG, "WebSocket push dropped, all slots busy (%u so far)", dropped);
+    return ESP_ERR_NO_MEM;
+}
+
+bool config_portal_has_listeners(void) {
+    return ws_server && atomic_load(&ws_client_count) > 0;
+}
+
+#else
+
+static void ws_init(void) {
+}
+
+esp_err_t config_portal_publish(const char *json, bool retain) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+bool config_portal_has_listeners(void) {
+    return false;
+}
+
+#endif // CONFIG_HTTPD_WS_SUPPORT
+
+
+// ======= Form parser =======
+// Parses an application/x-www-form-urlencoded body as it arrives. Only the
+// field being read is buffered, so memory use does not depend on the body
+// size, and all state lives in the caller's parser.
+
+#define FORM_KEY_MAX 32
+#define FORM_VALUE_MAX (3 * SETTINGS_VALUE_MAX) // before decoding, "%XX" per byte
+#define FORM_CHUNK_SIZE 128
+#define FORM_BODY_MAX 4096
+#define FORM_RECV_RETRIES 3
+
+typedef esp_err_t (*form_field_cb_t)(const char *key, const char *value, void *ctx);
+
+typedef struct {
+    char key[FORM_KEY_MAX];
+    char value[FORM_VALUE_MAX];
+    size_t key_len;
+    size_t value_len;
+    bool in_value;
+    esp_err_t err; // first error, stops the parse
+    form_field_cb_t cb;
+    void *ctx;
+} form_parser_t;
+
+static void form_parser_init(form_parser_t *parser, form_field_cb_t cb, void *ctx) {
+    memset(parser, 0, sizeof(*parser));
+    parser->err = ESP_OK;
+    parser->cb = cb;
+    parser->ctx = ctx;
+}
+
+// Decode the buffered field in place and hand it to the callback. A key
+// without '=' is rejected rather than read as an empty value, which would
+// clear the setting.
+static void form_parser_emit(form_parser_t *parser) {
+    if (parser->key_len > 0 && !parser->in_value && parser->err == ESP_OK) {
+        parser->err = ESP_ERR_INVALID_ARG;
+    } else if (parser->key_len > 0 && parser->err == ESP_OK) {
+        parser->key[parser->key_len] = '\0';
+        parser->value[parser->value_len] = '\0';
+        url_decode(parser->key, parser->key);
+        url_decode(parser->value, parser->value);
+        parser->err = parser->cb(parser->key, parser->value, parser->ctx);
+    }
+    parser->key_len = 0;
+    parser->value_len = 0;
+    parser->in_value = false;
+}
+
+static void form_parser_feed(form_parser_t *parser, const char *data, size_t len) {
+    for (size_t i = 0; i < len && parser->err == ESP_OK; i++) {
+        char c = data[i];
+        if (c == '&') {
+            form_parser_emit(parser);
+        } else if (c == '=' && !parser->in_value) {
+            parser->in_value = true;
+        } else if (parser->in_value) {
+            if (parser->value_len + 1 >= sizeof(parser->value)) parser->err = ESP_ERR_INVALID_SIZE;
+            else parser->value[parser->value_len++] = c;
+        } else {
+            if (parser->key_len + 1 >= sizeof(parser->key)) parser->err = ESP_ERR_INVALID_SIZE;
+            else parser->key[parser->key_len++] = c;
+        }
+    }
+}
+
+static esp_err_t form_parser_finish(form_parser_t *parser) {
+    form_parser_emit(parser);
+    return parser->err;
 }
 
 
 // ================= HTTP Handler =================
+static esp_err_t save_field(const char *key, const char *value, void *ctx) {
+    esp_err_t err = settings_set((settings_txn_t *)ctx, key, value);
+    return err == ESP_ERR_NOT_FOUND ? ESP_OK : err; // unknown fields are skipped
+}
+
 esp_err_t save_post_handler(httpd_req_t *req) {
-    char buf[512]; // buffer for form data
-    int ret = httpd_req_recv(req, buf, req->content_len);
-    if (ret <= 0) {
-        httpd_resp_send_500(req);
+    if (req->content_len > FORM_BODY_MAX) {
+        httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE, "Form too large");
         return ESP_FAIL;
     }
-    buf[ret] = 0; // null terminate
 
-    bool reboot_needed = false;
+    // Handlers run one at a time on the single server task, so the big
+    // buffers are static rather than on its stack, where the settings
+    // subscribers still have to fit on top of them
+    static settings_txn_t txn;
+    static form_parser_t parser;
+    static char chunk[FORM_CHUNK_SIZE];
+
+    // Stage every field, then write them with one NVS commit
+    settings_begin(&txn);
+    form_parser_init(&parser, save_field, &txn);
+
+    size_t remaining = req->content_len;
+    int retries = 0;
+    while (remaining > 0 && parser.err == ESP_OK) {
+        int ret = httpd_req_recv(req, chunk, MIN(remaining, sizeof(chunk)));
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= FORM_RECV_RETRIES) continue;
+        if (ret <= 0) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        form_parser_feed(&parser, chunk, ret);
+        remaining -= ret;
+    }
 
-    char *pair = strtok(buf, "&");
-    while (pair) {
-        char key[32], value[128];
-        if (sscanf(pair, "%31[^=]=%127s", key, value) == 2) {
-            char decoded[128];
-            url_decode(decoded, value);          // <--- decode URL encoding
-            save_setting(key, decoded);
+    // Nothing is written unless every field was valid
+    esp_err_t err = form_parser_finish(&parser);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Rejected form: %s", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid form field");
+        return ESP_FAIL;
+    }
 
-            if (strcmp(key, "ssid") == 0 || strcmp(key, "pass") == 0) {
-                reboot_needed = true;
-            }
-        }
-        pair = strtok(NULL, "&");
+    if (settings_commit(&txn) != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
     }
 
+    // Wi-Fi and the strip layout are only read at boot
+    bool reboot_needed = settings_changed(&txn, "ssid") || settings_changed(&txn, "pass") ||
+                         settings_changed(&txn, "strips") || settings_changed(&txn, "guilds");
+
         if (reboot_needed) {
         // For Wi-Fi changes, reboot anyway
-        httpd_resp_sendstr(req, "Wi-Fi settings saved. Rebooting...");
+        httpd_resp_sendstr(req, "Settings saved. Rebooting...");
         vTaskDelay(pdMS_TO_TICKS(1000));
         esp_restart();
     } else {
@@ -184,22 +654,54 @@ esp_err_t save_post_handler(httpd_req_t *req) {
 
 
 static esp_err_t settings_get_handler(httpd_req_t *req) {
-    char ssid[32] = "";
-    char pass[64] = "";
-    char led_color[8] = DEFAULT_COLOR;
+    // Static for the same reason as in save_post_handler()
+    static settings_t settings;
+    settings_get(&settings);
+
+    const struct {
+        const char *key;
+        const char *value;
+    } fields[] = {
+        { "ssid", settings.ssid },
+        { "pass", settings.pass },
+        { "led_color", settings.led_color },
+        { "segments", settings.segments },
+        { "guilds", settings.guilds },
+    };
 
-    load_setting("ssid", ssid, sizeof(ssid));
-    load_setting("pass", pass, sizeof(pass));
-    load_setting("led_color", led_color, sizeof(led_color));
+    httpd_resp_set_type(req, "application/json");
 
-    char buf[256];
-    int len = snprintf(buf, sizeof(buf),
-        "{ \"ssid\": \"%s\", \"pass\": \"%s\", \"led_color\": \"%s\" }",
-        ssid, pass, led_color);
+    // Streamed so every string can be escaped without sizing for the worst case
+    char head[32];
+    int len = snprintf(head, sizeof(head), "{ \"brightness\": %u", settings.brightness);
+    esp_err_t err = httpd_resp_send_chunk(req, head, len);
+    for (size_t i = 0; err == ESP_OK && i < sizeof(fields) / sizeof(fields[0]); i++) {
+        err = httpd_resp_sendstr_chunk(req, ", \"");
+        if (err == ESP_OK) err = httpd_resp_sendstr_chunk(req, fields[i].key);
+        if (err == ESP_OK) err = httpd_resp_sendstr_chunk(req, "\": \"");
+        if (err == ESP_OK) err = send_json_chunk(req, fields[i].value);
+        if (err == ESP_OK) err = httpd_resp_sendstr_chunk(req, "\"");
+    }
+    if (err == ESP_OK) err = httpd_resp_sendstr_chunk(req, " }");
+    if (err == ESP_OK) err = httpd_resp_send_chunk(req, NULL, 0); // end of response
+    return err;
+}
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, buf, len);
-    return ESP_OK;
+
+// ======= Metrics =======
+
+static esp_err_t metrics_write(void *ctx, const char *text, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, text, len);
+}
+
+// Prometheus text exposition, streamed line by line
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    esp_err_t err = metrics_render(metrics_write, req);
+    if (err != ESP_OK) return err;
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 
@@ -207,7 +709,25 @@ httpd_handle_t config_portal_start(void) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     httpd_handle_t server = NULL;
 
+    // httpd keeps three sockets for itself
+    config.max_open_sockets = MIN(CONFIG_PORTAL_HTTPD_MAX_SOCKETS, CONFIG_LWIP_MAX_SOCKETS - 3);
+#if CONFIG_PORTAL_HTTPD_LRU_PURGE
+    config.lru_purge_enable = true;
+#endif
+    config.task_priority = CONFIG_PORTAL_HTTPD_PRIORITY;
+    config.stack_size = CONFIG_PORTAL_HTTPD_STACK_SIZE;
+    config.core_id = CONFIG_PORTAL_HTTPD_CORE_ID < 0 ? tskNO_AFFINITY : CONFIG_PORTAL_HTTPD_CORE_ID;
+#if CONFIG_PORTAL_HTTPD_KEEP_ALIVE
+    config.keep_alive_enable = true;
+    config.keep_alive_idle = CONFIG_PORTAL_HTTPD_KEEP_ALIVE_IDLE;
+    config.keep_alive_interval = CONFIG_PORTAL_HTTPD_KEEP_ALIVE_INTERVAL;
+    config.keep_alive_count = CONFIG_PORTAL_HTTPD_KEEP_ALIVE_COUNT;
+#endif
+
     if (httpd_start(&server, &config) == ESP_OK) {
+        ESP_LOGI(TAG, "HTTP server started (%u sockets, priority %u, core %d)",
+                 config.max_open_sockets, config.task_priority, CONFIG_PORTAL_HTTPD_CORE_ID);
+
         httpd_uri_t index_uri = {
             .uri = "/",
             .method = HTTP_GET,
@@ -218,7 +738,8 @@ httpd_handle_t config_portal_start(void) {
         httpd_uri_t css_uri = {
             .uri = "/style.css",
             .method = HTTP_GET,
-            .handler = css_get_handler
+            .handler = static_asset_get_handler,
+            .user_ctx = (void *)&style_css_asset
         };
         httpd_register_uri_handler(server, &css_uri);
 
@@ -236,6 +757,25 @@ httpd_handle_t config_portal_start(void) {
             .handler = settings_get_handler
         };
         httpd_register_uri_handler(server, &settings_uri);
+
+        httpd_uri_t metrics_uri = {
+            .uri = "/metrics",
+            .method = HTTP_GET,
+            .handler = metrics_get_handler
+        };
+        httpd_register_uri_handler(server, &metrics_uri);
+
+#if CONFIG_HTTPD_WS_SUPPORT
+        httpd_uri_t ws_uri = {
+            .uri = "/ws",
+            .method = HTTP_GET,
+            .handler = ws_handler,
+            .is_websocket = true
+        };
+        httpd_register_uri_handler(server, &ws_uri);
+        atomic_store(&ws_client_count, 0);
+        ws_server = server;
+#endif
     }
     return server;
 }
@@ -243,6 +783,9 @@ httpd_handle_t config_portal_start(void) {
 
 void config_portal_stop(httpd_handle_t server) {
     if (server) {
+#if CONFIG_HTTPD_WS_SUPPORT
+        if (server == ws_server) ws_server = NULL;
+#endif
         httpd_stop(server);
     }
 }
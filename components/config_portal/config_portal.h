@@ -1,6 +1,8 @@
 #pragma once
+#include <stdbool.h>
 #include "esp_err.h"
 #include "esp_http_server.h"
+#include "settings.h"
 
 // Initialize the settings module (call once at startup)
 void config_portal_init(void);
@@ -8,6 +10,11 @@ void config_portal_init(void);
 httpd_handle_t config_portal_start(void);
 void config_portal_stop(httpd_handle_t server);
 
-// Save/load single key-value pair
-esp_err_t save_setting(const char* key, const char* value);
-esp_err_t load_setting(const char* key, char* value, size_t max_len);
+// Push a JSON message to every client connected to /ws. The text is copied
+// once and shared by all clients; retained messages are also sent to
+// clients that connect later. Safe to call from any task.
+esp_err_t config_portal_publish(const char *json, bool retain);
+
+// True while at least one /ws client is connected, lets callers skip
+// formatting messages nobody will read
+bool config_portal_has_listeners(void);
@@ -0,0 +1,24 @@
+# Pre-compresses one web asset and writes a header with its ETag.
+# The ETag hashes the uncompressed source, so it only changes with content.
+# The compressed variant gets its own ETag, a cache must not answer a
+# request for one encoding with the other.
+#
+# Usage: cmake -DSRC=<asset> -DHEADER=<etag.h> -DNAME=<c_identifier>
+#              [-DDST=<asset.gz>] -P gzip_asset.cmake
+
+if(DST)
+    file(ARCHIVE_CREATE OUTPUT "${DST}" PATHS "${SRC}"
+         FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+endif()
+
+file(SHA256 "${SRC}" hash)
+string(SUBSTRING "${hash}" 0 16 hash)
+string(TOUPPER "${NAME}" upper)
+file(WRITE "${HEADER}"
+     "#pragma once\n"
+     "// Generated by gzip_asset.cmake, do not edit\n"
+     "#define ${upper}_HASH \"${hash}\"\n"
+     "#define ${upper}_ETAG \"\\\"${hash}\\\"\"\n")
+if(DST)
+    file(APPEND "${HEADER}" "#define ${upper}_GZ_ETAG \"\\\"${hash}-gz\\\"\"\n")
+endif()
@@ -0,0 +1,269 @@
+#include "settings.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include "string.h"
+#include "stdlib.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "stdio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char* TAG = "settings";
+
+#define SETTINGS_NAMESPACE "config"
+#define MAX_SUBSCRIBERS 4
+
+
+// ======= Key table =======
+
+typedef enum {
+    SETTING_STR,
+    SETTING_U8,
+} setting_type_t;
+
+typedef struct {
+    const char* key;
+    setting_type_t type;
+    size_t offset;
+    size_t size;
+    const char* def; // value used while the key is not in NVS
+} setting_desc_t;
+
+#define SETTING(name, type, def) \
+    { #name, type, offsetof(settings_t, name), sizeof(((settings_t*)0)->name), def }
+
+static const setting_desc_t setting_descs[] = {
+    SETTING(ssid, SETTING_STR, ""),
+    SETTING(pass, SETTING_STR, ""),
+    SETTING(led_color, SETTING_STR, "#23A55A"),
+    SETTING(brightness, SETTING_U8, "255"),
+    SETTING(segments, SETTING_STR, ""),
+    SETTING(strips, SETTING_STR, ""),
+    SETTING(guilds, SETTING_STR, ""),
+};
+
+#define SETTING_COUNT ((int)(sizeof(setting_descs) / sizeof(setting_descs[0])))
+
+
+// ======= Cache state =======
+
+static settings_t cache;
+static uint32_t cache_present = 0; // bit per setting_descs entry found in NVS
+static SemaphoreHandle_t cache_lock = NULL;
+static StaticSemaphore_t cache_lock_buf;
+
+static struct {
+    settings_change_cb_t cb;
+    void* ctx;
+} subscribers[MAX_SUBSCRIBERS];
+
+
+// ======= Helpers =======
+
+static int find_setting(const char* key) {
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        if (strcmp(setting_descs[i].key, key) == 0) return i;
+    }
+    return -1;
+}
+
+// Parse a string value into its cache field
+static esp_err_t setting_from_str(const setting_desc_t* desc, settings_t* dst, const char* value) {
+    void* field = (char*)dst + desc->offset;
+
+    switch (desc->type) {
+        case SETTING_STR:
+            if (strlen(value) >= desc->size) return ESP_ERR_INVALID_SIZE;
+            strcpy((char*)field, value);
+            return ESP_OK;
+
+        case SETTING_U8: {
+            char* end;
+            long n = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || n < 0 || n > 255) return ESP_ERR_INVALID_ARG;
+            *(uint8_t*)field = (uint8_t)n;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+// Format a cache field back into the string stored in NVS
+static esp_err_t setting_to_str(const setting_desc_t* desc, const settings_t* src, char* value, size_t max_len) {
+    const void* field = (const char*)src + desc->offset;
+    int len = 0;
+
+    switch (desc->type) {
+        case SETTING_STR:
+            len = snprintf(value, max_len, "%s", (const char*)field);
+            break;
+        case SETTING_U8:
+            len = snprintf(value, max_len, "%u", *(const uint8_t*)field);
+            break;
+    }
+    return (len < 0 || (size_t)len >= max_len) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+static void notify_subscribers(const char* key) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].cb) subscribers[i].cb(key, subscribers[i].ctx);
+    }
+}
+
+
+// ======= Public API =======
+
+esp_err_t settings_init(void) {
+    if (!cache_lock) {
+        cache_lock = xSemaphoreCreateMutexStatic(&cache_lock_buf);
+    }
+
+    memset(&cache, 0, sizeof(cache));
+    cache_present = 0;
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        setting_from_str(&setting_descs[i], &cache, setting_descs[i].def);
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) return ESP_OK; // nothing saved yet
+    if (err != ESP_OK) return err;
+
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        char value[SETTINGS_VALUE_MAX];
+        size_t len = sizeof(value);
+        if (nvs_get_str(handle, setting_descs[i].key, value, &len) != ESP_OK) continue;
+
+        if (setting_from_str(&setting_descs[i], &cache, value) == ESP_OK) {
+            cache_present |= 1u << i;
+        } else {
+            ESP_LOGW(TAG, "Ignoring invalid stored value for '%s'", setting_descs[i].key);
+        }
+    }
+    nvs_close(handle);
+
+    ESP_LOGI(TAG, "Loaded %d settings from NVS", __builtin_popcount(cache_present));
+    return ESP_OK;
+}
+
+void settings_get(settings_t* out) {
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    *out = cache;
+    xSemaphoreGive(cache_lock);
+}
+
+esp_err_t settings_format(const settings_t* settings, const char* key, char* value, size_t max_len) {
+    int idx = find_setting(key);
+    if (idx < 0) return ESP_ERR_NOT_FOUND;
+    return setting_to_str(&setting_descs[idx], settings, value, max_len);
+}
+
+esp_err_t settings_subscribe(settings_change_cb_t cb, void* ctx) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (!subscribers[i].cb) {
+            subscribers[i].ctx = ctx;
+            subscribers[i].cb = cb;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void settings_begin(settings_txn_t* txn) {
+    settings_get(&txn->staged);
+    txn->dirty = 0;
+}
+
+esp_err_t settings_set(settings_txn_t* txn, const char* key, const char* value) {
+    int idx = find_setting(key);
+    if (idx < 0) {
+        ESP_LOGW(TAG, "Unknown key='%s'", key);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Validate before anything reaches flash
+    const setting_desc_t* desc = &setting_descs[idx];
+    esp_err_t err = setting_from_str(desc, &txn->staged, value);
+    if (err != ESP_OK) return err;
+
+    // Skip the write if NVS already holds this exact value
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    bool unchanged = (cache_present & (1u << idx)) &&
+        memcmp((char*)&cache + desc->offset, (char*)&txn->staged + desc->offset, desc->size) == 0;
+    xSemaphoreGive(cache_lock);
+
+    if (unchanged) {
+        txn->dirty &= ~(1u << idx);
+    } else {
+        txn->dirty |= 1u << idx;
+    }
+    return ESP_OK;
+}
+
+bool settings_changed(const settings_txn_t* txn, const char* key) {
+    int idx = find_setting(key);
+    return idx >= 0 && (txn->dirty & (1u << idx));
+}
+
+esp_err_t settings_commit(settings_txn_t* txn) {
+    if (txn->dirty == 0) return ESP_OK;
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+
+    // Holding the lock keeps concurrent commits from interleaving, and
+    // guards the value buffer kept off the caller's stack
+    static char value[SETTINGS_VALUE_MAX];
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    for (int i = 0; i < SETTING_COUNT && err == ESP_OK; i++) {
+        if (!(txn->dirty & (1u << i))) continue;
+
+        err = setting_to_str(&setting_descs[i], &txn->staged, value, sizeof(value));
+        if (err == ESP_OK) err = nvs_set_str(handle, setting_descs[i].key, value);
+        if (err == ESP_OK) ESP_LOGI(TAG, "Saved key='%s', value='%s'", setting_descs[i].key, value);
+    }
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+
+    // Write-through: flash first, then the cache
+    if (err == ESP_OK) {
+        for (int i = 0; i < SETTING_COUNT; i++) {
+            if (!(txn->dirty & (1u << i))) continue;
+            memcpy((char*)&cache + setting_descs[i].offset,
+                   (char*)&txn->staged + setting_descs[i].offset, setting_descs[i].size);
+            cache_present |= 1u << i;
+        }
+    }
+    xSemaphoreGive(cache_lock);
+    if (err != ESP_OK) return err;
+
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        if (txn->dirty & (1u << i)) notify_subscribers(setting_descs[i].key);
+    }
+    return ESP_OK;
+}
+
+esp_err_t save_setting(const char* key, const char* value) {
+    settings_txn_t txn;
+    settings_begin(&txn);
+
+    esp_err_t err = settings_set(&txn, key, value);
+    if (err != ESP_OK) return err;
+    return settings_commit(&txn);
+}
+
+esp_err_t load_setting(const char* key, char* value, size_t max_len) {
+    int idx = find_setting(key);
+    if (idx < 0) return ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (cache_present & (1u << idx)) {
+        err = setting_to_str(&setting_descs[idx], &cache, value, max_len);
+    }
+    xSemaphoreGive(cache_lock);
+    return err;
+}
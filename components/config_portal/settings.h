@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest value of any setting as a string, including the terminator
+#define SETTINGS_VALUE_MAX 256
+
+// Typed copy of the "config" NVS namespace, missing keys hold their defaults
+typedef struct {
+    char ssid[33];
+    char pass[65];
+    char led_color[8];
+    uint8_t brightness;
+    char segments[SETTINGS_VALUE_MAX]; // "start:length:channel:effect;..."
+    char strips[64];                   // "gpio:count;...", read at boot
+    char guilds[192];                  // "guild,guild,...", read at boot, empty for all
+} settings_t;
+
+// Pending changes, filled by settings_set() and written by settings_commit()
+typedef struct {
+    settings_t staged;
+    uint32_t dirty; // bit per changed key
+} settings_txn_t;
+
+// Called after a setting was written, from the task that wrote it
+typedef void (*settings_change_cb_t)(const char* key, void* ctx);
+
+// Load the whole namespace into RAM (called by config_portal_init)
+esp_err_t settings_init(void);
+
+// Copy of the current settings, never touches flash
+void settings_get(settings_t* out);
+
+// Format one field of a settings copy as a string, including defaults
+esp_err_t settings_format(const settings_t* settings, const char* key, char* value, size_t max_len);
+
+// Register a callback for setting changes
+esp_err_t settings_subscribe(settings_change_cb_t cb, void* ctx);
+
+// Start a transaction from the current settings
+void settings_begin(settings_txn_t* txn);
+
+// Stage one value, values equal to what is stored are not marked dirty
+esp_err_t settings_set(settings_txn_t* txn, const char* key, const char* value);
+
+// True if the key was staged with a new value
+bool settings_changed(const settings_txn_t* txn, const char* key);
+
+// Write all dirty keys with a single NVS commit, then notify subscribers
+esp_err_t settings_commit(settings_txn_t* txn);
+
+// Save/load single key-value pair, values are passed as strings.
+// load_setting() returns ESP_ERR_NVS_NOT_FOUND for keys that were never saved.
+esp_err_t save_setting(const char* key, const char* value);
+esp_err_t load_setting(const char* key, char* value, size_t max_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,41 +1,292 @@
 #include "led_animation.h"
 #include "config_portal.h"
+#include "led_framebuffer.h"
+#include "led_effects.h"
+#include "led_segments.h"
+#include "metrics.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_bit_defs.h"
+#include "driver/gpio.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
 #define DEFAULT_COLOR "#800000"  // fallback color if NVS not found
-#define LED_TASK_STACK 2048
-#define LED_TASK_PRIORITY 5
-#define LED_UPDATE_MS 50
+#define DEFAULT_BRIGHTNESS 255
+#define LED_FRAME_US (1000000 / CONFIG_LED_ANIMATION_FPS)
+#define LED_STATS_LOG_US (10 * 1000000) // debug summary of frame timing
 
-static led_strip_handle_t strip_handle = NULL;
-static led_animation_type_t current_animation = LED_ANIM_OFF;
-static uint8_t led_color[3];
+// Notification bits for the LED task
+#define LED_NOTIFY_CHANGE BIT0 // render state changed
+#define LED_NOTIFY_FRAME  BIT1 // frame clock tick
+
+static const char *TAG = "led_animation";
+
+static TaskHandle_t led_task_handle = NULL;
+static StackType_t led_task_stack[CONFIG_LED_TASK_STACK_SIZE];
+static StaticTask_t led_task_buf;
+static esp_timer_handle_t frame_timer = NULL;
+static _Atomic led_animation_type_t current_animation = LED_ANIM_OFF;
+static _Atomic uint32_t current_level = 0; // level << 16 | level_max
+static _Atomic led_transition_type_t transition_type = LED_TRANSITION_FADE;
+static _Atomic uint32_t transition_ms = CONFIG_LED_TRANSITION_MS;
+static _Atomic uint32_t current_color = 0;       // 0x00RRGGBB
+static _Atomic uint32_t current_brightness = DEFAULT_BRIGHTNESS;
+static _Atomic uint32_t period_override[LED_ANIM_COUNT]; // 0 keeps the default
+static atomic_bool full_redraw = true; // something every pixel depends on changed
+static atomic_bool suspended = false;  // strip dark and unpowered until resumed
+
+// Segment table as last saved, written by the settings callback and copied
+// by the LED task when segments_changed is set
+static led_segment_t pending_segments[CONFIG_LED_SEGMENT_MAX];
+static size_t pending_segment_count = 0;
+static SemaphoreHandle_t segments_lock = NULL;
+static StaticSemaphore_t segments_lock_buf;
+static atomic_bool segments_changed = false;
+static _Atomic uint32_t segment_dirty = 0; // bit per segment to redraw
+
+static _Atomic(led_level_source_t) level_source = NULL;
+static _Atomic uint32_t segment_level_max = 0;
+
+// LED task's own copy of the table, with per-segment effect state
+typedef struct {
+    bool active;      // channel occupied, effect shown
+    int64_t start_us; // effect time base, restarts when the segment lights up
+} segment_state_t;
+
+static led_segment_t segments[CONFIG_LED_SEGMENT_MAX];
+static segment_state_t segment_states[CONFIG_LED_SEGMENT_MAX];
+static size_t segment_count = 0;
+
+// Copy of the frame shown when the running transition started
+static led_rgb_t transition_from[CONFIG_LED_STRIP_LED_COUNT];
+
+// Written by the LED task after every frame
+METRICS_COUNTER(frames_missed, "led_frames_missed_total",
+                "Frame clock ticks skipped because a frame overran");
+METRICS_HISTOGRAM(render_hist, "led_frame_render_us", "Time to render and refresh one frame",
+                  250, 500, 1000, 2000, 4000, 8000, 16000, 33000);
+METRICS_HISTOGRAM(jitter_hist, "led_frame_jitter_us", "Delay from a frame clock tick to the frame start",
+                  50, 100, 250, 500, 1000, 2000, 5000, 10000);
 
 static void led_task(void *arg);
 static void parse_hex_color(const char *hex, uint8_t *rgb);
+static void load_led_settings(void);
+static void load_segments(void);
+static void setting_changed(const char *key, void *ctx);
+static void frame_timer_callback(void *arg);
+static void strip_power(bool on);
+
+void led_animation_init(const led_strip_handle_t *strips, const size_t *lengths, size_t strip_count)
+{
+    led_framebuffer_init(strips, lengths, strip_count);
+#if CONFIG_LED_STRIP_POWER_GPIO >= 0
+    gpio_reset_pin(CONFIG_LED_STRIP_POWER_GPIO);
+    gpio_set_direction(CONFIG_LED_STRIP_POWER_GPIO, GPIO_MODE_OUTPUT);
+    // Keep driving the pin through light sleep instead of floating it
+    gpio_sleep_sel_dis(CONFIG_LED_STRIP_POWER_GPIO);
+    strip_power(true);
+#endif
+    if (!segments_lock) {
+        segments_lock = xSemaphoreCreateMutexStatic(&segments_lock_buf);
+    }
+    metrics_register_counter(&frames_missed);
+    metrics_register_histogram(&render_hist);
+    metrics_register_histogram(&jitter_hist);
+
+    load_led_settings();
+    load_segments();
+    led_framebuffer_set_brightness((uint8_t)atomic_load(&current_brightness));
+    settings_subscribe(setting_changed, NULL);
+
+    // Frames are paced by a periodic esp_timer rather than a tick delay,
+    // so the rate neither depends on the tick rate nor drifts by the
+    // render time
+    const esp_timer_create_args_t timer_args = {
+        .callback = frame_timer_callback,
+        .name = "led_frame",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &frame_timer));
+
+    // Static like the framebuffers, the task never touches the heap
+    led_task_handle = xTaskCreateStaticPinnedToCore(led_task, "led_animation", CONFIG_LED_TASK_STACK_SIZE, NULL,
+                                                    CONFIG_LED_TASK_PRIORITY, led_task_stack, &led_task_buf,
+                                                    CONFIG_LED_TASK_CORE_ID < 0 ? tskNO_AFFINITY : CONFIG_LED_TASK_CORE_ID);
+}
+
+void led_animation_get_frame_stats(led_frame_stats_t *out)
+{
+    out->frames = metrics_histogram_count(&render_hist);
+    out->timed_frames = metrics_histogram_count(&jitter_hist);
+    out->missed = atomic_load_explicit(&frames_missed.value, memory_order_relaxed);
+    out->render_us_total = metrics_histogram_sum(&render_hist);
+    out->render_us_p99 = metrics_histogram_quantile(&render_hist, 0.99f);
+    out->jitter_us_total = metrics_histogram_sum(&jitter_hist);
+    out->jitter_us_p99 = metrics_histogram_quantile(&jitter_hist, 0.99f);
+}
+
+// Wake the task to draw with the new render state
+static void led_animation_wake(void)
+{
+    if (led_task_handle) {
+        xTaskNotify(led_task_handle, LED_NOTIFY_CHANGE, eSetBits);
+    }
+}
 
-void led_animation_init(led_strip_handle_t strip)
+// Same, for changes that affect every pixel
+static void led_animation_redraw(void)
+{
+    atomic_store(&full_redraw, true);
+    led_animation_wake();
+}
+
+void led_animation_suspend(void)
+{
+    if (!atomic_exchange(&suspended, true)) {
+        led_animation_wake();
+    }
+}
+
+void led_animation_resume(void)
+{
+    if (atomic_exchange(&suspended, false)) {
+        led_animation_wake();
+    }
+}
+
+void led_animation_set(led_animation_type_t anim)
 {
-    strip_handle = strip;
+    // Only wake the task when there is something new to draw
+    if (atomic_exchange(&current_animation, anim) != anim) {
+        led_animation_wake();
+    }
+}
+
+void led_animation_set_color(uint8_t r, uint8_t g, uint8_t b)
+{
+    uint32_t packed = ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    if (atomic_exchange(&current_color, packed) != packed) {
+        led_animation_redraw();
+    }
+}
+
+void led_animation_set_brightness(uint8_t brightness)
+{
+    // Applied when the pixels are encoded, nothing has to be drawn again
+    if (atomic_exchange(&current_brightness, brightness) != brightness) {
+        led_animation_wake();
+    }
+}
+
+void led_animation_set_params(led_animation_type_t anim, const led_animation_params_t *params)
+{
+    if ((unsigned)anim >= LED_ANIM_COUNT) return;
+
+    // Segments may use the effect too, so redraw even if it is not current
+    uint32_t period = params ? params->period_ms : 0;
+    if (atomic_exchange(&period_override[anim], period) != period) {
+        led_animation_redraw();
+    }
+}
+
+void led_animation_set_transition(led_transition_type_t type, uint32_t duration_ms)
+{
+    atomic_store(&transition_type, type);
+    atomic_store(&transition_ms, duration_ms);
+}
+
+void led_animation_set_level(uint16_t level, uint16_t level_max)
+{
+    uint32_t packed = ((uint32_t)level << 16) | level_max;
+    if (atomic_exchange(&current_level, packed) != packed) {
+        led_animation_redraw();
+    }
+}
+
+void led_animation_set_level_source(led_level_source_t source, uint16_t level_max)
+{
+    atomic_store(&segment_level_max, level_max);
+    if (atomic_exchange(&level_source, source) != source) {
+        led_animation_redraw();
+    }
+}
+
+void led_animation_mark_channel(uint64_t guild_id, uint64_t channel_id)
+{
+    bool all = guild_id == 0 && channel_id == 0;
+    uint32_t dirty = 0;
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    for (size_t i = 0; i < pending_segment_count; i++) {
+        const led_segment_t *seg = &pending_segments[i];
+        bool follows = seg->channel_id ? seg->channel_id == channel_id
+                                       : (seg->guild_id == 0 || seg->guild_id == guild_id);
+        if (all || follows) dirty |= 1u << i;
+    }
+    xSemaphoreGive(segments_lock);
+
+    if (dirty) {
+        atomic_fetch_or(&segment_dirty, dirty);
+        led_animation_wake();
+    }
+}
+
+// ================== Internal helpers ==================
 
+// Push the stored colour and brightness into the render state
+static void load_led_settings(void)
+{
     char color_str[8] = {0};
     if (load_setting("led_color", color_str, sizeof(color_str)) != ESP_OK) {
         strncpy(color_str, DEFAULT_COLOR, sizeof(color_str));
     }
-    parse_hex_color(color_str, led_color);
+    uint8_t rgb[3];
+    parse_hex_color(color_str, rgb);
+    led_animation_set_color(rgb[0], rgb[1], rgb[2]);
 
-    xTaskCreate(led_task, "led_animation", LED_TASK_STACK, NULL,
-                LED_TASK_PRIORITY, NULL);
+    char brightness_str[4] = {0};
+    int brightness = DEFAULT_BRIGHTNESS;
+    if (load_setting("brightness", brightness_str, sizeof(brightness_str)) == ESP_OK) {
+        brightness = atoi(brightness_str);
+        if (brightness < 0) brightness = 0;
+        if (brightness > 255) brightness = 255;
+    }
+    led_animation_set_brightness((uint8_t)brightness);
 }
 
-void led_animation_set(led_animation_type_t anim)
+// Parse the stored segment table and hand it to the LED task. Runs on the
+// portal's stack after a save, so it parses straight into the pending table
+// under its lock instead of keeping copies on the stack.
+static void load_segments(void)
 {
-    current_animation = anim;
+    static char segments_str[SETTINGS_VALUE_MAX]; // guarded by segments_lock
+
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    if (load_setting("segments", segments_str, sizeof(segments_str)) != ESP_OK) {
+        segments_str[0] = '\0';
+    }
+    pending_segment_count = led_segments_parse(segments_str, pending_segments, CONFIG_LED_SEGMENT_MAX,
+                                               CONFIG_LED_STRIP_LED_COUNT);
+    xSemaphoreGive(segments_lock);
+
+    atomic_store(&segments_changed, true);
+    led_animation_redraw();
 }
 
-// ================== Internal helpers ==================
+// Runs on the task that saved the setting, e.g. the portal's /save handler
+static void setting_changed(const char *key, void *ctx)
+{
+    if (strcmp(key, "led_color") == 0 || strcmp(key, "brightness") == 0) {
+        load_led_settings();
+    } else if (strcmp(key, "segments") == 0) {
+        load_segments();
+    }
+}
 
 static void parse_hex_color(const char *color, uint8_t *rgb)
 {
@@ -56,36 +307,250 @@ static void parse_hex_color(const char *color, uint8_t *rgb)
     }
 }
 
+// Effect defaults with the runtime colour and period applied
+static led_effect_params_t effect_params(led_animation_type_t anim, const led_effect_t *effect)
+{
+    led_effect_params_t params = effect->params;
+    uint32_t color = atomic_load(&current_color);
+    params.color = (led_rgb_t){ color >> 16, (color >> 8) & 0xFF, color & 0xFF };
+    uint32_t period = (unsigned)anim < LED_ANIM_COUNT ? atomic_load(&period_override[anim]) : 0;
+    if (period) params.period_ms = period;
+    return params;
+}
+
+// Draw the segments over the frame. Segments that are static and not dirty
+// are skipped unless full is set, the back buffer still holds them.
+// Returns true if any segment needs to be drawn every frame.
+static bool render_segments(led_rgb_t *frame, size_t count, int64_t now_us, bool full)
+{
+    if (atomic_exchange(&segments_changed, false)) {
+        xSemaphoreTake(segments_lock, portMAX_DELAY);
+        memcpy(segments, pending_segments, pending_segment_count * sizeof(led_segment_t));
+        segment_count = pending_segment_count;
+        xSemaphoreGive(segments_lock);
+        memset(segment_states, 0, sizeof(segment_states));
+    }
+
+    // Until the voice state is known the whole strip shows the animation
+    led_level_source_t source = atomic_load(&level_source);
+    if (!source) return false;
+
+    uint32_t dirty = atomic_exchange(&segment_dirty, 0);
+    uint16_t level_max = (uint16_t)atomic_load(&segment_level_max);
+    bool animated = false;
+
+    for (size_t i = 0; i < segment_count; i++) {
+        const led_segment_t *seg = &segments[i];
+        segment_state_t *state = &segment_states[i];
+        if (seg->start >= count) continue;
+
+        uint16_t level = source(seg->guild_id, seg->channel_id);
+        if ((level > 0) != state->active) {
+            state->active = level > 0;
+            state->start_us = now_us;
+            dirty |= 1u << i;
+        }
+
+        led_animation_type_t type = state->active ? seg->effect : LED_ANIM_OFF;
+        const led_effect_t *effect = led_effect_get(type);
+        animated |= effect->animated;
+        if (!full && !effect->animated && !(dirty & (1u << i))) continue;
+
+        led_effect_params_t params = effect_params(type, effect);
+        params.level = level;
+        params.level_max = level_max;
+        if (effect->init) effect->init(&params);
+
+        size_t len = seg->length < count - seg->start ? seg->length : count - seg->start;
+        effect->render(frame + seg->start, len, (uint32_t)((now_us - state->start_us) / 1000), &params);
+    }
+    return animated;
+}
+
+static void strip_power(bool on)
+{
+#if CONFIG_LED_STRIP_POWER_GPIO >= 0
+#if CONFIG_LED_STRIP_POWER_ACTIVE_HIGH
+    gpio_set_level(CONFIG_LED_STRIP_POWER_GPIO, on);
+#else
+    gpio_set_level(CONFIG_LED_STRIP_POWER_GPIO, !on);
+#endif
+#endif
+}
+
+static void frame_timer_callback(void *arg)
+{
+    xTaskNotify(led_task_handle, LED_NOTIFY_FRAME, eSetBits);
+}
+
+// Account one frame. due_us is the frame clock slot the frame was drawn
+// for, 0 for frames drawn on a change.
+static void record_frame(int64_t start_us, int64_t end_us, int64_t due_us, uint32_t missed)
+{
+    metrics_histogram_observe(&render_hist, (uint32_t)(end_us - start_us));
+    if (due_us) {
+        metrics_histogram_observe(&jitter_hist, start_us > due_us ? (uint32_t)(start_us - due_us) : 0);
+    }
+    if (missed) {
+        metrics_counter_add(&frames_missed, missed);
+    }
+}
+
+// Debug summary of the frames since the last one
+static void log_frame_stats(led_frame_stats_t *last)
+{
+    led_frame_stats_t now;
+    led_animation_get_frame_stats(&now);
+
+    uint32_t frames = now.frames - last->frames;
+    uint32_t timed = now.timed_frames - last->timed_frames;
+    if (frames > 0) {
+        ESP_LOGD(TAG, "%lu frames (%lu timed, %lu missed), render avg %lu us, jitter avg %lu us p99 %lu us",
+                 (unsigned long)frames, (unsigned long)timed,
+                 (unsigned long)(now.missed - last->missed),
+                 (unsigned long)((now.render_us_total - last->render_us_total) / frames),
+                 (unsigned long)(timed ? (now.jitter_us_total - last->jitter_us_total) / timed : 0),
+                 (unsigned long)now.jitter_us_p99);
+    }
+    *last = now;
+}
+
 static void led_task(void *arg)
 {
-    int blink = 0;
+    led_animation_type_t last_anim = LED_ANIM_COUNT;
+    int64_t anim_start_us = 0;
+    led_transition_type_t fade_type = LED_TRANSITION_NONE;
+    uint32_t fade_ms = 0;
+    uint32_t brightness = atomic_load(&current_brightness);
+    bool was_transitioning = false;
+    bool tick = false; // woken by the frame clock
+    bool clock_running = false;
+    int64_t next_due_us = 0; // slot of the next frame clock tick
+    int64_t next_log_us = esp_timer_get_time() + LED_STATS_LOG_US;
+    led_frame_stats_t logged = {0};
 
     while (1) {
-        switch (current_animation) {
-        case LED_ANIM_OFF:
-            led_strip_clear(strip_handle);
-            break;
-
-        case LED_ANIM_SOLID:
-            for (int i = 0; i < CONFIG_LED_STRIP_LED_COUNT; i++) {
-                led_strip_set_pixel(strip_handle, i,
-                                    led_color[0], led_color[1], led_color[2]);
+        // A suspend waits until the change that came with it, usually the
+        // switch to off, has been drawn and its transition played out
+        if (atomic_load(&suspended) && atomic_load(&current_animation) == last_anim && !was_transitioning) {
+            // The strip latches the last frame it got, so blank it before
+            // cutting the power, then ignore every change until resumed
+            led_framebuffer_fill(led_framebuffer_back(), led_framebuffer_size(), (led_rgb_t){ 0, 0, 0 });
+            led_framebuffer_present();
+            if (clock_running) {
+                esp_timer_stop(frame_timer);
+                clock_running = false;
             }
-            led_strip_refresh(strip_handle);
-            break;
-
-        case LED_ANIM_BLINK:
-            blink = !blink;
-            for (int i = 0; i < CONFIG_LED_STRIP_LED_COUNT; i++) {
-                led_strip_set_pixel(strip_handle, i,
-                                    blink ? led_color[0] : 0,
-                                    blink ? led_color[1] : 0,
-                                    blink ? led_color[2] : 0);
+            strip_power(false);
+
+            while (atomic_load(&suspended)) {
+                xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+            }
+
+            strip_power(true);
+#if CONFIG_LED_STRIP_POWER_GPIO >= 0
+            // Rounded up to a tick, 5 ms is 0 ticks at the default 100 Hz
+            vTaskDelay(MAX(pdMS_TO_TICKS(CONFIG_LED_STRIP_POWER_ON_DELAY_MS), 1));
+#endif
+            // Whatever changed while suspended is drawn now, fading in
+            // from the black frame
+            atomic_store(&full_redraw, true);
+            tick = false;
+        }
+
+        led_animation_type_t anim = atomic_load(&current_animation);
+        const led_effect_t *effect = led_effect_get(anim);
+        led_rgb_t *frame = led_framebuffer_back();
+        size_t count = led_framebuffer_size();
+
+        int64_t now_us = esp_timer_get_time();
+        int64_t due_us = 0;
+        uint32_t missed = 0;
+        if (tick && clock_running) {
+            // A frame that overran its slot leaves a single pending tick,
+            // count the ones it swallowed and move on to the next slot
+            due_us = next_due_us;
+            if (now_us >= due_us + LED_FRAME_US) {
+                missed = (uint32_t)((now_us - due_us) / LED_FRAME_US);
+                due_us += (int64_t)missed * LED_FRAME_US;
             }
-            led_strip_refresh(strip_handle);
-            break;
+            next_due_us = due_us + LED_FRAME_US;
         }
 
-        vTaskDelay(pdMS_TO_TICKS(LED_UPDATE_MS));
+        // Effect time starts over whenever the animation changes
+        bool full = atomic_exchange(&full_redraw, false) || was_transitioning;
+        if (anim != last_anim) {
+            full = true;
+            // The back buffer still holds what is on the strip, including
+            // a half-finished transition, so start the new one from there
+            if (last_anim != LED_ANIM_COUNT) {
+                memcpy(transition_from, frame, count * sizeof(led_rgb_t));
+                fade_type = atomic_load(&transition_type);
+                fade_ms = atomic_load(&transition_ms);
+            }
+            last_anim = anim;
+            anim_start_us = now_us;
+        }
+        uint32_t t_ms = (uint32_t)((now_us - anim_start_us) / 1000);
+
+        // The LUT is only touched from this task, the setter just records the value
+        uint32_t new_brightness = atomic_load(&current_brightness);
+        if (new_brightness != brightness) {
+            brightness = new_brightness;
+            led_framebuffer_set_brightness((uint8_t)brightness);
+        }
+
+        // The back buffer keeps the last frame, so a static animation is
+        // only drawn again when something it depends on changed
+        if (full || effect->animated) {
+            led_effect_params_t params = effect_params(anim, effect);
+            uint32_t level = atomic_load(&current_level);
+            params.level = level >> 16;
+            params.level_max = level & 0xFFFF;
+            if (effect->init) effect->init(&params);
+
+            effect->render(frame, count, t_ms, &params);
+            full = true; // segments on top have to be drawn again too
+        }
+        bool segments_animated = render_segments(frame, count, now_us, full);
+
+        bool transitioning = fade_type != LED_TRANSITION_NONE && t_ms < fade_ms;
+        was_transitioning = transitioning;
+        if (transitioning) {
+            led_framebuffer_blend(frame, transition_from, count, fade_type,
+                                  (uint8_t)(t_ms * 255 / fade_ms));
+        }
+
+        // Skips the refresh entirely if the frame did not change
+        led_framebuffer_present();
+        int64_t end_us = esp_timer_get_time();
+        record_frame(now_us, end_us, due_us, missed);
+
+        if (end_us >= next_log_us) {
+            log_frame_stats(&logged);
+            next_log_us = end_us + LED_STATS_LOG_US;
+        }
+
+        // Run the frame clock only while something moves, otherwise sleep
+        // until the next change
+        bool animated = effect->animated || segments_animated || transitioning;
+        if (animated && !clock_running) {
+            next_due_us = esp_timer_get_time() + LED_FRAME_US;
+            esp_timer_start_periodic(frame_timer, LED_FRAME_US);
+            clock_running = true;
+        } else if (!animated && clock_running) {
+            esp_timer_stop(frame_timer);
+            clock_running = false;
+        }
+
+        // Once the transition is over a pending suspend needs no further wake
+        if (atomic_load(&suspended) && !transitioning) {
+            tick = false;
+            continue;
+        }
+
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+        tick = (bits & LED_NOTIFY_FRAME) != 0;
     }
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include "led_strip.h"
 
 #ifdef __cplusplus
@@ -10,18 +11,152 @@ typedef enum {
     LED_ANIM_OFF = 0,
     LED_ANIM_SOLID,
     LED_ANIM_BLINK,
+    LED_ANIM_BREATHE,
+    LED_ANIM_CHASE,
+    LED_ANIM_RAINBOW,
+    LED_ANIM_OCCUPANCY,
+    LED_ANIM_COUNT,
 } led_animation_type_t;
 
+typedef enum {
+    LED_TRANSITION_NONE = 0, // switch on the next frame
+    LED_TRANSITION_FADE,     // crossfade from the old to the new frame
+    LED_TRANSITION_WIPE,     // new frame sweeps in from the first LED
+} led_transition_type_t;
+
+/**
+ * @brief Runtime overrides for an animation's defaults
+ */
+typedef struct {
+    uint32_t period_ms; // length of one animation cycle, 0 for the default
+} led_animation_params_t;
+
 /**
  * @brief Initialize LED animation system
+ *
+ * The strips are treated as one long strip, in the order given, with
+ * lengths[i] LEDs on strips[i].
+ *
+ * Loads colour and brightness from the settings and follows later changes
+ * to them, so a save through the portal shows up on the next frame.
  */
-void led_animation_init(led_strip_handle_t strip);
+void led_animation_init(const led_strip_handle_t *strips, const size_t *lengths, size_t strip_count);
 
 /**
  * @brief Change current animation
+ *
+ * Safe to call from any task and never blocks. The change is played with
+ * the configured transition; calling again while a transition is running
+ * starts a new one from whatever is currently shown, so the last call wins.
+ * Static animations are drawn once and the LED task then sleeps until the
+ * next change.
  */
 void led_animation_set(led_animation_type_t anim);
 
+/**
+ * @brief Set the fill level shown by LED_ANIM_OCCUPANCY
+ *
+ * @param level     Current value, e.g. users in voice
+ * @param level_max Value at which the whole strip is lit
+ */
+void led_animation_set_level(uint16_t level, uint16_t level_max);
+
+/**
+ * @brief Set the colour used by all single-colour animations
+ *
+ * Safe to call from any task, applied on the next frame.
+ */
+void led_animation_set_color(uint8_t r, uint8_t g, uint8_t b);
+
+/**
+ * @brief Set the global brightness, 0-255
+ *
+ * Safe to call from any task, applied on the next frame.
+ */
+void led_animation_set_brightness(uint8_t brightness);
+
+/**
+ * @brief Override the defaults of one animation
+ *
+ * @param params New values, or NULL to go back to the defaults
+ */
+void led_animation_set_params(led_animation_type_t anim, const led_animation_params_t *params);
+
+/**
+ * @brief Occupancy of a voice channel
+ *
+ * A channel_id of 0 asks for every channel of the guild, and both 0 for
+ * every channel of every guild. Called from the LED task while drawing,
+ * so it has to be cheap and must not block.
+ */
+typedef uint16_t (*led_level_source_t)(uint64_t guild_id, uint64_t channel_id);
+
+/**
+ * @brief Start drawing the segment table from the "segments" setting
+ *
+ * Each segment shows its effect while source() reports its channel as
+ * occupied and is dark otherwise; LEDs outside all segments keep showing
+ * the animation. Until this is called the whole strip shows the animation.
+ *
+ * @param level_max Level at which bar effects in a segment are full
+ */
+void led_animation_set_level_source(led_level_source_t source, uint16_t level_max);
+
+/**
+ * @brief Redraw the segments whose level depends on a channel
+ *
+ * Call after the occupancy of the channel changed, with the guild it
+ * belongs to. That redraws the segments following the channel, its
+ * guild or all channels. Both 0 redraws every segment. Segments that
+ * were not marked are left as they are.
+ */
+void led_animation_mark_channel(uint64_t guild_id, uint64_t channel_id);
+
+/**
+ * @brief Blank the strip, switch off its power and stop drawing
+ *
+ * A transition that is running, or started by a change made just before,
+ * is played to its end first. Every change made while suspended is kept
+ * and shown on resume. The strip power pin is only switched if
+ * LED_STRIP_POWER_GPIO is set.
+ */
+void led_animation_suspend(void);
+
+/**
+ * @brief Power the strip up again and draw the current state
+ */
+void led_animation_resume(void);
+
+/**
+ * @brief Choose how animation changes are played
+ *
+ * @param duration_ms Length of the transition, 0 switches immediately
+ */
+void led_animation_set_transition(led_transition_type_t type, uint32_t duration_ms);
+
+/**
+ * @brief Frame timing counters, totals since boot
+ *
+ * Jitter is how late an animation frame started compared to its slot on
+ * the frame clock. Frames drawn for a change outside the schedule count
+ * towards frames and render time only. The same numbers are exported on
+ * /metrics as histograms.
+ */
+typedef struct {
+    uint32_t frames;          // frames drawn
+    uint32_t timed_frames;    // of those, drawn for a frame clock tick
+    uint32_t missed;          // ticks skipped because a frame overran
+    uint64_t render_us_total; // render and refresh time
+    uint32_t render_us_p99;   // estimated from the histogram buckets
+    uint64_t jitter_us_total; // over timed_frames
+    uint32_t jitter_us_p99;
+} led_frame_stats_t;
+
+/**
+ * @brief Read the frame timing counters, never blocks
+ */
+void led_animation_get_frame_stats(led_frame_stats_t *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,132 @@
+#include "led_effects.h"
+#include "led_fixed.h"
+#include <string.h>
+
+#define WHITE { 255, 255, 255 }
+
+// ================== Kernels ==================
+
+static void sanitize_params(led_effect_params_t *params)
+{
+    if (params->period_ms == 0) params->period_ms = 1000;
+    if (params->level_max == 0) params->level_max = 1;
+}
+
+static void render_off(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                       const led_effect_params_t *params)
+{
+    led_rgb_t black = { 0, 0, 0 };
+    led_framebuffer_fill(frame, count, black);
+}
+
+static void render_solid(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                         const led_effect_params_t *params)
+{
+    led_framebuffer_fill(frame, count, params->color);
+}
+
+static void render_blink(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                         const led_effect_params_t *params)
+{
+    led_rgb_t black = { 0, 0, 0 };
+    bool on = phase8(t_ms, params->period_ms) < 128;
+    led_framebuffer_fill(frame, count, on ? params->color : black);
+}
+
+static void render_breathe(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                           const led_effect_params_t *params)
+{
+    // Start from the dark end of the wave
+    uint8_t amount = sin8(phase8(t_ms, params->period_ms) - 64);
+    led_framebuffer_fill(frame, count, scale_rgb(params->color, amount));
+}
+
+static void render_chase(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                         const led_effect_params_t *params)
+{
+    size_t head = (size_t)(((uint64_t)(t_ms % params->period_ms) * count) / params->period_ms);
+    size_t tail = count / 8 ? count / 8 : 1;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t dist = (head + count - i) % count;
+        uint8_t amount = dist < tail ? (uint8_t)(255 - dist * 255 / tail) : 0;
+        frame[i] = scale_rgb(params->color, amount);
+    }
+}
+
+static void render_rainbow(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                           const led_effect_params_t *params)
+{
+    uint8_t base = phase8(t_ms, params->period_ms);
+
+    for (size_t i = 0; i < count; i++) {
+        frame[i] = hsv2rgb((uint8_t)(base + i * 256 / count), 255, 255);
+    }
+}
+
+static void render_occupancy(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                             const led_effect_params_t *params)
+{
+    uint32_t level = params->level < params->level_max ? params->level : params->level_max;
+
+    // Lit length in 1/256 pixels, the last pixel is partially lit
+    uint32_t lit = (uint32_t)(((uint64_t)level * count * 256) / params->level_max);
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t start = (uint32_t)i * 256;
+        uint8_t amount = lit >= start + 256 ? 255 : lit > start ? (uint8_t)(lit - start) : 0;
+        frame[i] = scale_rgb(params->color, amount);
+    }
+}
+
+// ================== Registry ==================
+
+static const led_effect_t effects[LED_ANIM_COUNT] = {
+    [LED_ANIM_OFF] = {
+        .name = "off", .animated = false,
+        .render = render_off,
+    },
+    [LED_ANIM_SOLID] = {
+        .name = "solid", .animated = false,
+        .render = render_solid,
+    },
+    [LED_ANIM_BLINK] = {
+        .name = "blink", .animated = true,
+        .init = sanitize_params, .render = render_blink,
+        .params = { .color = WHITE, .period_ms = 100 },
+    },
+    [LED_ANIM_BREATHE] = {
+        .name = "breathe", .animated = true,
+        .init = sanitize_params, .render = render_breathe,
+        .params = { .color = WHITE, .period_ms = 4000 },
+    },
+    [LED_ANIM_CHASE] = {
+        .name = "chase", .animated = true,
+        .init = sanitize_params, .render = render_chase,
+        .params = { .color = WHITE, .period_ms = 2000 },
+    },
+    [LED_ANIM_RAINBOW] = {
+        .name = "rainbow", .animated = true,
+        .init = sanitize_params, .render = render_rainbow,
+        .params = { .period_ms = 5000 },
+    },
+    [LED_ANIM_OCCUPANCY] = {
+        .name = "occupancy", .animated = false,
+        .init = sanitize_params, .render = render_occupancy,
+        .params = { .color = WHITE, .level_max = 8 },
+    },
+};
+
+const led_effect_t *led_effect_get(led_animation_type_t type)
+{
+    if ((unsigned)type >= LED_ANIM_COUNT) type = LED_ANIM_OFF;
+    return &effects[type];
+}
+
+led_animation_type_t led_effect_find(const char *name)
+{
+    for (int i = 0; i < LED_ANIM_COUNT; i++) {
+        if (strcmp(effects[i].name, name) == 0) return (led_animation_type_t)i;
+    }
+    return LED_ANIM_COUNT;
+}
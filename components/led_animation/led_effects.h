@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "led_animation.h"
+#include "led_framebuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Tunables shared by all effects, each effect uses what it needs
+ */
+typedef struct {
+    led_rgb_t color;
+    uint32_t period_ms;  // length of one animation cycle
+    uint16_t level;      // filled amount for bar effects
+    uint16_t level_max;  // level at which a bar is full
+} led_effect_params_t;
+
+/**
+ * @brief Entry in the effect registry
+ *
+ * render() must be a pure function of its arguments so effects stay
+ * frame-time correct no matter how often they are drawn.
+ */
+typedef struct {
+    const char *name;
+    bool animated; // needs to be redrawn every frame
+    void (*init)(led_effect_params_t *params); // optional, sanitizes params
+    void (*render)(led_rgb_t *frame, size_t count, uint32_t t_ms,
+                   const led_effect_params_t *params);
+    led_effect_params_t params; // defaults
+} led_effect_t;
+
+/**
+ * @brief Look up the registry entry for an animation type
+ *
+ * @return The effect, or the OFF effect for unknown types
+ */
+const led_effect_t *led_effect_get(led_animation_type_t type);
+
+/**
+ * @brief Look up an animation type by its effect name
+ *
+ * @return The type, or LED_ANIM_COUNT if no effect has that name
+ */
+led_animation_type_t led_effect_find(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#include "led_fixed.h"
+
+// Quarter sine wave, 127 * sin(i / 64 * pi / 2)
+static const uint8_t quarter_sine[65] = {
+      0,   3,   6,   9,  12,  16,  19,  22,  25,  28,  31,  34,  37,  40,  43,  46,
+     49,  51,  54,  57,  60,  63,  65,  68,  71,  73,  76,  78,  81,  83,  85,  88,
+     90,  92,  94,  96,  98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+    117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+    127,
+};
+
+uint8_t sin8(uint8_t theta)
+{
+    uint8_t idx = theta & 63;
+
+    switch (theta >> 6) {
+    case 0:  return 128 + quarter_sine[idx];
+    case 1:  return 128 + quarter_sine[64 - idx];
+    case 2:  return 128 - quarter_sine[idx];
+    default: return 128 - quarter_sine[64 - idx];
+    }
+}
+
+led_rgb_t hsv2rgb(uint8_t h, uint8_t s, uint8_t v)
+{
+    led_rgb_t out = { v, v, v };
+    if (s == 0) return out;
+
+    uint8_t region = h / 43;
+    uint8_t rem = (h - region * 43) * 6;
+
+    uint8_t p = (v * (255 - s)) >> 8;
+    uint8_t q = (v * (255 - ((s * rem) >> 8))) >> 8;
+    uint8_t t = (v * (255 - ((s * (255 - rem)) >> 8))) >> 8;
+
+    switch (region) {
+    case 0:  out = (led_rgb_t){ v, t, p }; break;
+    case 1:  out = (led_rgb_t){ q, v, p }; break;
+    case 2:  out = (led_rgb_t){ p, v, t }; break;
+    case 3:  out = (led_rgb_t){ p, q, v }; break;
+    case 4:  out = (led_rgb_t){ t, p, v }; break;
+    default: out = (led_rgb_t){ v, p, q }; break;
+    }
+    return out;
+}
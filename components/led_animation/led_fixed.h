@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include "led_framebuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Integer-only helpers for effect kernels. Angles and fractions are 8-bit:
+// 256 is one full turn, 255 is "1.0".
+
+/**
+ * @brief a * b / 255, rounded
+ */
+static inline uint8_t scale8(uint8_t a, uint8_t b)
+{
+    uint16_t x = (uint16_t)a * b + 128;
+    return (uint8_t)((x + (x >> 8)) >> 8);
+}
+
+/**
+ * @brief Linear blend from a to b, amount 0 is a and 255 is b
+ */
+static inline uint8_t lerp8(uint8_t a, uint8_t b, uint8_t amount)
+{
+    return (uint8_t)(a + (((int)b - a) * amount + 127) / 255);
+}
+
+static inline led_rgb_t scale_rgb(led_rgb_t c, uint8_t amount)
+{
+    led_rgb_t out = { scale8(c.r, amount), scale8(c.g, amount), scale8(c.b, amount) };
+    return out;
+}
+
+static inline led_rgb_t lerp_rgb(led_rgb_t a, led_rgb_t b, uint8_t amount)
+{
+    led_rgb_t out = { lerp8(a.r, b.r, amount), lerp8(a.g, b.g, amount), lerp8(a.b, b.b, amount) };
+    return out;
+}
+
+/**
+ * @brief Sine on an 8-bit angle, mapped to 0..255 (128 at angle 0)
+ */
+uint8_t sin8(uint8_t theta);
+
+/**
+ * @brief Convert an 8-bit hue/saturation/value triple to RGB
+ */
+led_rgb_t hsv2rgb(uint8_t h, uint8_t s, uint8_t v);
+
+/**
+ * @brief Position of t_ms within a period, as an 8-bit angle
+ */
+static inline uint8_t phase8(uint32_t t_ms, uint32_t period_ms)
+{
+    if (period_ms == 0) return 0;
+    return (uint8_t)(((uint64_t)(t_ms % period_ms) << 8) / period_ms);
+}
+
+#ifdef __cplusplus
+}
+#endif
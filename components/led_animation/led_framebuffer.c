@@ -0,0 +1,152 @@
+#include "led_framebuffer.h"
+#include "led_fixed.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+typedef struct {
+    led_strip_handle_t handle;
+    size_t offset; // first framebuffer pixel on this strip
+    size_t length;
+} fb_strip_t;
+
+static fb_strip_t fb_strips[LED_FRAMEBUFFER_MAX_STRIPS];
+static size_t fb_strip_count = 0;
+static size_t fb_count = 0;
+static bool fb_front_valid = false;
+
+static led_rgb_t fb_back[CONFIG_LED_STRIP_LED_COUNT];
+static led_rgb_t fb_front[CONFIG_LED_STRIP_LED_COUNT];
+
+// Gamma 2.2 correction, 255 * (i / 255)^2.2
+static const uint8_t gamma_table[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+// gamma_table scaled by the global brightness, applied while encoding
+static uint8_t fb_lut[256];
+static uint8_t fb_brightness = 0;
+static bool fb_lut_valid = false; // brightness 0 leaves the LUT all zeros
+
+void led_framebuffer_init(const led_strip_handle_t *strips, const size_t *lengths, size_t strip_count)
+{
+    fb_strip_count = 0;
+    fb_count = 0;
+    for (size_t s = 0; s < strip_count && s < LED_FRAMEBUFFER_MAX_STRIPS; s++) {
+        size_t room = CONFIG_LED_STRIP_LED_COUNT - fb_count;
+        if (room == 0) break;
+
+        fb_strip_t *strip = &fb_strips[fb_strip_count++];
+        strip->handle = strips[s];
+        strip->offset = fb_count;
+        strip->length = lengths[s] < room ? lengths[s] : room;
+        fb_count += strip->length;
+    }
+    fb_front_valid = false;
+    memset(fb_back, 0, sizeof(fb_back));
+    led_framebuffer_set_brightness(255);
+}
+
+void led_framebuffer_set_brightness(uint8_t brightness)
+{
+    if (fb_lut_valid && brightness == fb_brightness) return;
+
+    fb_brightness = brightness;
+    for (int i = 0; i < 256; i++) {
+        fb_lut[i] = (uint8_t)((gamma_table[i] * brightness + 127) / 255);
+    }
+    fb_lut_valid = true;
+
+    // Every pixel encodes differently now
+    fb_front_valid = false;
+}
+
+led_rgb_t *led_framebuffer_back(void)
+{
+    return fb_back;
+}
+
+size_t led_framebuffer_size(void)
+{
+    return fb_count;
+}
+
+bool led_framebuffer_present(void)
+{
+    size_t bytes = fb_count * sizeof(led_rgb_t);
+
+    if (fb_front_valid && memcmp(fb_back, fb_front, bytes) == 0) {
+        return false;
+    }
+
+    // The driver keeps its own encoded copy, so only changed pixels need
+    // to be re-encoded before the refresh sends the whole strip out.
+    // Every strip has its own RMT channel: start all transfers, then wait.
+    bool started[LED_FRAMEBUFFER_MAX_STRIPS] = {0};
+    for (size_t s = 0; s < fb_strip_count; s++) {
+        const fb_strip_t *strip = &fb_strips[s];
+        bool changed = !fb_front_valid;
+
+        for (size_t i = 0; i < strip->length; i++) {
+            const led_rgb_t *px = &fb_back[strip->offset + i];
+            const led_rgb_t *old = &fb_front[strip->offset + i];
+            if (fb_front_valid && px->r == old->r && px->g == old->g && px->b == old->b) {
+                continue;
+            }
+            led_strip_set_pixel(strip->handle, i, fb_lut[px->r], fb_lut[px->g], fb_lut[px->b]);
+            changed = true;
+        }
+        if (changed) {
+            started[s] = led_strip_refresh_async(strip->handle) == ESP_OK;
+        }
+    }
+    for (size_t s = 0; s < fb_strip_count; s++) {
+        if (started[s]) led_strip_refresh_wait_done(fb_strips[s].handle);
+    }
+
+    memcpy(fb_front, fb_back, bytes);
+    fb_front_valid = true;
+    return true;
+}
+
+void led_framebuffer_fill(led_rgb_t *buf, size_t count, led_rgb_t color)
+{
+    for (size_t i = 0; i < count; i++) {
+        buf[i] = color;
+    }
+}
+
+void led_framebuffer_blend(led_rgb_t *frame, const led_rgb_t *from, size_t count,
+                           led_transition_type_t type, uint8_t progress)
+{
+    switch (type) {
+    case LED_TRANSITION_FADE:
+        for (size_t i = 0; i < count; i++) {
+            frame[i] = lerp_rgb(from[i], frame[i], progress);
+        }
+        break;
+
+    case LED_TRANSITION_WIPE: {
+        // Pixels past the wipe edge still show the old frame
+        size_t edge = (count * progress + 127) / 255;
+        memcpy(frame + edge, from + edge, (count - edge) * sizeof(led_rgb_t));
+    } break;
+
+    default:
+        break;
+    }
+}
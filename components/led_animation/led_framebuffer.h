@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "led_strip.h"
+#include "led_animation.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LED_FRAMEBUFFER_MAX_STRIPS 4
+
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} led_rgb_t;
+
+/**
+ * @brief Bind the framebuffer to one or more strips, the next present pushes every pixel
+ *
+ * The strips are laid out one after another: pixel 0 is the first LED of
+ * strips[0], pixel lengths[0] the first LED of strips[1], and so on. The
+ * total is capped at CONFIG_LED_STRIP_LED_COUNT.
+ */
+void led_framebuffer_init(const led_strip_handle_t *strips, const size_t *lengths, size_t strip_count);
+
+/**
+ * @brief Set the global brightness applied on top of gamma correction
+ *
+ * Rebuilds the 256-entry lookup table used when encoding pixels, so it is
+ * cheap to call repeatedly with the same value.
+ */
+void led_framebuffer_set_brightness(uint8_t brightness);
+
+/**
+ * @brief Back buffer that animations render into
+ */
+led_rgb_t *led_framebuffer_back(void);
+
+/**
+ * @brief Number of pixels in the framebuffer
+ */
+size_t led_framebuffer_size(void);
+
+/**
+ * @brief Push the back buffer to the strips
+ *
+ * Only pixels that differ from the last presented frame are gamma corrected,
+ * dimmed and handed to the driver, and strips without changes are not
+ * refreshed at all. The others are refreshed in parallel, so the call takes
+ * as long as the longest changed strip.
+ *
+ * @return true if any strip was refreshed
+ */
+bool led_framebuffer_present(void);
+
+/**
+ * @brief Fill a run of pixels with one colour
+ */
+void led_framebuffer_fill(led_rgb_t *buf, size_t count, led_rgb_t color);
+
+/**
+ * @brief Blend a previous frame into a freshly rendered one
+ *
+ * @param frame    New frame, overwritten with the blended result
+ * @param from     Frame shown when the transition started
+ * @param progress 0 shows only `from`, 255 only the new frame
+ */
+void led_framebuffer_blend(led_rgb_t *frame, const led_rgb_t *from, size_t count,
+                           led_transition_type_t type, uint8_t progress);
+
+#ifdef __cplusplus
+}
+#endif
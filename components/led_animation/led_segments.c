@@ -0,0 +1,82 @@
+#include "led_segments.h"
+#include "led_effects.h"
+#include "esp_log.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "led_segments";
+
+#define SEGMENT_ENTRY_MAX 64
+
+// Parse an unsigned decimal field, the whole string has to be a number
+static bool parse_u64(const char *str, uint64_t *out)
+{
+    if (!str || *str < '0' || *str > '9') return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    *out = value;
+    return true;
+}
+
+static bool parse_entry(char *entry, led_segment_t *seg, size_t led_count)
+{
+    char *fields[4];
+    char *save = NULL;
+    int n = 0;
+    for (char *tok = strtok_r(entry, ":", &save); tok; tok = strtok_r(NULL, ":", &save)) {
+        if (n == 4) return false;
+        fields[n++] = tok;
+    }
+    if (n != 4) return false;
+
+    uint64_t start, length, channel = 0, guild = 0;
+    bool follows_guild = fields[2][0] == 'g';
+    if (!parse_u64(fields[0], &start) || !parse_u64(fields[1], &length) ||
+        !parse_u64(fields[2] + follows_guild, follows_guild ? &guild : &channel)) {
+        return false;
+    }
+    if (start >= led_count || length == 0) return false;
+
+    led_animation_type_t effect = led_effect_find(fields[3]);
+    if (effect == LED_ANIM_COUNT) return false;
+
+    seg->start = (uint16_t)start;
+    seg->length = (uint16_t)(length > led_count - start ? led_count - start : length);
+    seg->effect = effect;
+    seg->channel_id = channel;
+    seg->guild_id = guild;
+    return true;
+}
+
+size_t led_segments_parse(const char *str, led_segment_t *out, size_t max_segments, size_t led_count)
+{
+    size_t count = 0;
+    const char *p = str;
+
+    while (p && *p) {
+        const char *end = strchr(p, ';');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        if (len > 0) {
+            char entry[SEGMENT_ENTRY_MAX];
+            bool ok = false;
+            if (len < sizeof(entry) && count < max_segments) {
+                memcpy(entry, p, len);
+                entry[len] = '\0';
+                ok = parse_entry(entry, &out[count], led_count);
+            }
+            if (ok) {
+                count++;
+            } else {
+                ESP_LOGW(TAG, "Ignoring segment '%.*s'", (int)len, p);
+            }
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return count;
+}
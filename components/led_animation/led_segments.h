@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "led_animation.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A slice of the strip with its own effect and channel
+ */
+typedef struct {
+    uint16_t start;               // first LED
+    uint16_t length;              // number of LEDs, clipped to the strip
+    led_animation_type_t effect;  // drawn while the channel is occupied
+    uint64_t channel_id;          // voice channel followed, 0 for a whole guild
+    uint64_t guild_id;            // guild followed if channel_id is 0, 0 for all guilds
+} led_segment_t;
+
+/**
+ * @brief Parse a segment table such as "0:100:123456789012345678:solid;100:50:g987654321098765432:occupancy"
+ *
+ * Entries are "start:length:channel:effect", separated by ';'. The effect
+ * is given by name, the channel as a snowflake, as "g" followed by a guild
+ * snowflake for every channel of that guild, or 0 for all channels.
+ * Invalid entries are logged and skipped.
+ *
+ * @return Number of segments written to out
+ */
+size_t led_segments_parse(const char *str, led_segment_t *out, size_t max_segments, size_t led_count);
+
+#ifdef __cplusplus
+}
+#endif
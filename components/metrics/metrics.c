@@ -0,0 +1,252 @@
+#include "metrics.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+#define METRICS_MAX_COUNTERS 16
+#define METRICS_MAX_HISTOGRAMS 8
+#define METRICS_MAX_COLLECTORS 4
+#define METRICS_MAX_TASKS 32
+#define METRICS_LINE_MAX 160
+
+static _Atomic(metrics_counter_t *) counters[METRICS_MAX_COUNTERS];
+static _Atomic(metrics_histogram_t *) histograms[METRICS_MAX_HISTOGRAMS];
+static _Atomic(metrics_collector_t) collectors[METRICS_MAX_COLLECTORS];
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+#endif
+
+#if CONFIG_METRICS_HEAP_COUNTS
+static _Atomic uint32_t heap_allocs;
+static _Atomic uint32_t heap_frees;
+
+// Heap hooks, called by every malloc and free including those from ISRs
+// and with the flash cache disabled
+IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (ptr) atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+}
+
+IRAM_ATTR void esp_heap_trace_free_hook(void *ptr)
+{
+    if (ptr) atomic_fetch_add_explicit(&heap_frees, 1, memory_order_relaxed);
+}
+#endif
+
+// Output sink plus the first error it returned
+typedef struct {
+    metrics_write_fn_t write;
+    void *ctx;
+    esp_err_t err;
+} metrics_out_t;
+
+
+// ======= Registry =======
+
+esp_err_t metrics_register_counter(metrics_counter_t *counter)
+{
+    for (size_t i = 0; i < METRICS_MAX_COUNTERS; i++) {
+        metrics_counter_t *expected = NULL;
+        if (atomic_load(&counters[i]) == counter) return ESP_OK;
+        if (atomic_compare_exchange_strong(&counters[i], &expected, counter)) return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t metrics_register_histogram(metrics_histogram_t *hist)
+{
+    for (size_t i = 0; i < METRICS_MAX_HISTOGRAMS; i++) {
+        metrics_histogram_t *expected = NULL;
+        if (atomic_load(&histograms[i]) == hist) return ESP_OK;
+        if (atomic_compare_exchange_strong(&histograms[i], &expected, hist)) return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t metrics_register_collector(metrics_collector_t collector)
+{
+    for (size_t i = 0; i < METRICS_MAX_COLLECTORS; i++) {
+        metrics_collector_t expected = NULL;
+        if (atomic_load(&collectors[i]) == collector) return ESP_OK;
+        if (atomic_compare_exchange_strong(&collectors[i], &expected, collector)) return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+
+// ======= Histograms =======
+
+void metrics_histogram_observe(metrics_histogram_t *hist, uint32_t value)
+{
+    size_t i = 0;
+    while (i < hist->bound_count && value > hist->bounds[i]) i++;
+    atomic_fetch_add_explicit(&hist->buckets[i], 1, memory_order_relaxed);
+
+    uint32_t seq = atomic_load_explicit(&hist->seq, memory_order_relaxed);
+    atomic_store_explicit(&hist->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    hist->sum += value;
+    atomic_store_explicit(&hist->seq, seq + 2, memory_order_release);
+}
+
+uint64_t metrics_histogram_sum(metrics_histogram_t *hist)
+{
+    uint32_t before, after;
+    uint64_t sum;
+    do {
+        before = atomic_load_explicit(&hist->seq, memory_order_acquire);
+        sum = hist->sum;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&hist->seq, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return sum;
+}
+
+uint32_t metrics_histogram_count(metrics_histogram_t *hist)
+{
+    uint32_t total = 0;
+    for (size_t i = 0; i <= hist->bound_count; i++) {
+        total += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    }
+    return total;
+}
+
+uint32_t metrics_histogram_quantile(metrics_histogram_t *hist, float q)
+{
+    uint32_t total = metrics_histogram_count(hist);
+    if (total == 0 || hist->bound_count == 0) return 0;
+
+    float rank = q * total;
+    uint32_t below = 0;
+    for (size_t i = 0; i < hist->bound_count; i++) {
+        uint32_t in_bucket = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (in_bucket > 0 && below + in_bucket >= rank) {
+            uint32_t lower = i ? hist->bounds[i - 1] : 0;
+            float fraction = (rank - below) / in_bucket;
+            return lower + (uint32_t)(fraction * (hist->bounds[i] - lower));
+        }
+        below += in_bucket;
+    }
+    return hist->bounds[hist->bound_count - 1];
+}
+
+
+// ======= Rendering =======
+
+static void out_printf(metrics_out_t *out, const char *fmt, ...)
+{
+    if (out->err != ESP_OK) return;
+
+    char line[METRICS_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len < 0) return;
+    if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+    out->err = out->write(out->ctx, line, len);
+}
+
+static void out_header(metrics_out_t *out, const char *name, const char *type, const char *help)
+{
+    out_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void render_system(metrics_out_t *out)
+{
+    out_header(out, "uptime_seconds", "gauge", "Time since boot");
+    out_printf(out, "uptime_seconds %lld\n", (long long)(esp_timer_get_time() / 1000000));
+
+    out_header(out, "heap_free_bytes", "gauge", "Free 8-bit capable heap");
+    out_printf(out, "heap_free_bytes %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    out_header(out, "heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    out_printf(out, "heap_min_free_bytes %u\n", (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    out_header(out, "heap_largest_free_block_bytes", "gauge", "Largest allocatable block, falls with fragmentation");
+    out_printf(out, "heap_largest_free_block_bytes %u\n", (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+#if CONFIG_METRICS_HEAP_COUNTS
+    // Flat in steady state for everything this firmware allocates itself
+    uint32_t allocs, frees;
+    metrics_heap_counts(&allocs, &frees);
+    out_header(out, "heap_allocs_total", "counter", "Heap allocations since boot");
+    out_printf(out, "heap_allocs_total %u\n", (unsigned)allocs);
+    out_header(out, "heap_frees_total", "counter", "Heap frees since boot");
+    out_printf(out, "heap_frees_total %u\n", (unsigned)frees);
+#endif
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    // uxTaskGetSystemState() fills nothing at all if the buffer is too
+    // small, so report the shortfall rather than silently losing every task
+    UBaseType_t task_count = uxTaskGetNumberOfTasks();
+    UBaseType_t tasks = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, NULL);
+    out_header(out, "task_stats_truncated", "gauge", "1 if there are more tasks than the stack report has room for");
+    out_printf(out, "task_stats_truncated %d\n", task_count > METRICS_MAX_TASKS || tasks == 0 ? 1 : 0);
+    out_header(out, "task_stack_free_min_bytes", "gauge", "Stack high-water mark, lowest free stack per task");
+    for (UBaseType_t i = 0; i < tasks; i++) {
+        out_printf(out, "task_stack_free_min_bytes{task=\"%s\"} %u\n",
+                   task_status[i].pcTaskName, (unsigned)task_status[i].usStackHighWaterMark);
+    }
+#endif
+}
+
+static void render_histogram(metrics_out_t *out, metrics_histogram_t *hist)
+{
+    out_header(out, hist->name, "histogram", hist->help);
+
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < hist->bound_count; i++) {
+        cumulative += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        out_printf(out, "%s_bucket{le=\"%u\"} %u\n", hist->name, (unsigned)hist->bounds[i], (unsigned)cumulative);
+    }
+    cumulative += atomic_load_explicit(&hist->buckets[hist->bound_count], memory_order_relaxed);
+    out_printf(out, "%s_bucket{le=\"+Inf\"} %u\n", hist->name, (unsigned)cumulative);
+    out_printf(out, "%s_sum %llu\n", hist->name, (unsigned long long)metrics_histogram_sum(hist));
+    out_printf(out, "%s_count %u\n", hist->name, (unsigned)cumulative);
+
+    // Estimated on the device so a plain scrape shows them without PromQL
+    out_printf(out, "# TYPE %s_quantile gauge\n", hist->name);
+    out_printf(out, "%s_quantile{quantile=\"0.5\"} %u\n", hist->name, (unsigned)metrics_histogram_quantile(hist, 0.5f));
+    out_printf(out, "%s_quantile{quantile=\"0.99\"} %u\n", hist->name, (unsigned)metrics_histogram_quantile(hist, 0.99f));
+}
+
+void metrics_heap_counts(uint32_t *allocs, uint32_t *frees)
+{
+#if CONFIG_METRICS_HEAP_COUNTS
+    *allocs = atomic_load_explicit(&heap_allocs, memory_order_relaxed);
+    *frees = atomic_load_explicit(&heap_frees, memory_order_relaxed);
+#else
+    *allocs = 0;
+    *frees = 0;
+#endif
+}
+
+esp_err_t metrics_render(metrics_write_fn_t write, void *ctx)
+{
+    metrics_out_t out = { .write = write, .ctx = ctx, .err = ESP_OK };
+
+    render_system(&out);
+
+    for (size_t i = 0; i < METRICS_MAX_COUNTERS; i++) {
+        metrics_counter_t *counter = atomic_load(&counters[i]);
+        if (!counter) continue;
+        out_header(&out, counter->name, "counter", counter->help);
+        out_printf(&out, "%s %u\n", counter->name,
+                   (unsigned)atomic_load_explicit(&counter->value, memory_order_relaxed));
+    }
+
+    for (size_t i = 0; i < METRICS_MAX_HISTOGRAMS; i++) {
+        metrics_histogram_t *hist = atomic_load(&histograms[i]);
+        if (hist) render_histogram(&out, hist);
+    }
+
+    for (size_t i = 0; i < METRICS_MAX_COLLECTORS && out.err == ESP_OK; i++) {
+        metrics_collector_t collector = atomic_load(&collectors[i]);
+        if (collector) out.err = collector(write, ctx);
+    }
+    return out.err;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Counters and histograms exported in Prometheus text format. Updating a
+// metric is a relaxed atomic add and never blocks, so it is safe on any
+// hot path; only rendering walks the registry.
+
+/**
+ * @brief Monotonic counter
+ */
+typedef struct {
+    const char *name;
+    const char *help;
+    _Atomic uint32_t value;
+} metrics_counter_t;
+
+/**
+ * @brief Histogram over fixed bucket bounds
+ *
+ * Each histogram has a single writer. The 64-bit sum is guarded by a
+ * sequence counter instead of a lock, readers retry while it is odd.
+ */
+typedef struct {
+    const char *name;
+    const char *help;
+    const uint32_t *bounds;   // inclusive upper bounds, ascending
+    size_t bound_count;
+    _Atomic uint32_t *buckets; // bound_count + 1, the last one counts values above all bounds
+    _Atomic uint32_t seq;
+    volatile uint64_t sum;
+} metrics_histogram_t;
+
+#define METRICS_COUNTER(var, metric_name, metric_help) \
+    static metrics_counter_t var = { .name = metric_name, .help = metric_help }
+
+#define METRICS_HISTOGRAM(var, metric_name, metric_help, ...)                                  \
+    static const uint32_t var##_bounds[] = { __VA_ARGS__ };                                    \
+    static _Atomic uint32_t var##_buckets[sizeof(var##_bounds) / sizeof(var##_bounds[0]) + 1]; \
+    static metrics_histogram_t var = {                                                         \
+        .name = metric_name,                                                                   \
+        .help = metric_help,                                                                   \
+        .bounds = var##_bounds,                                                                \
+        .bound_count = sizeof(var##_bounds) / sizeof(var##_bounds[0]),                         \
+        .buckets = var##_buckets,                                                              \
+    }
+
+static inline void metrics_counter_add(metrics_counter_t *counter, uint32_t n)
+{
+    atomic_fetch_add_explicit(&counter->value, n, memory_order_relaxed);
+}
+
+/**
+ * @brief Record one value, from the histogram's writer only
+ */
+void metrics_histogram_observe(metrics_histogram_t *hist, uint32_t value);
+
+/**
+ * @brief Estimate a quantile from the buckets
+ *
+ * Interpolates linearly inside the bucket the quantile falls into, values
+ * above the last bound are reported as the last bound.
+ *
+ * @param q Quantile, 0.0 to 1.0
+ */
+uint32_t metrics_histogram_quantile(metrics_histogram_t *hist, float q);
+
+/**
+ * @brief Number of values recorded
+ */
+uint32_t metrics_histogram_count(metrics_histogram_t *hist);
+
+/**
+ * @brief Sum of the values recorded
+ */
+uint64_t metrics_histogram_sum(metrics_histogram_t *hist);
+
+/**
+ * @brief Add a metric to the /metrics output, usually from an init function
+ *
+ * @return ESP_ERR_NO_MEM if the registry is full
+ */
+esp_err_t metrics_register_counter(metrics_counter_t *counter);
+esp_err_t metrics_register_histogram(metrics_histogram_t *hist);
+
+/**
+ * @brief Sink for rendered text, a non-ESP_OK result stops rendering
+ */
+typedef esp_err_t (*metrics_write_fn_t)(void *ctx, const char *text, size_t len);
+
+/**
+ * @brief Renders metrics that do not fit a counter or histogram
+ *
+ * Called after the registered metrics with the same sink, has to write
+ * complete lines including their # TYPE header.
+ */
+typedef esp_err_t (*metrics_collector_t)(metrics_write_fn_t write, void *ctx);
+
+esp_err_t metrics_register_collector(metrics_collector_t collector);
+
+/**
+ * @brief Heap allocations and frees since boot, both 0 unless
+ *        CONFIG_METRICS_HEAP_COUNTS is set
+ */
+void metrics_heap_counts(uint32_t *allocs, uint32_t *frees);
+
+/**
+ * @brief Render heap, task and registered metrics in Prometheus text format
+ *
+ * Called from one task at a time, the task list is kept in a static buffer.
+ */
+esp_err_t metrics_render(metrics_write_fn_t write, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
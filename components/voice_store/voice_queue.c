@@ -0,0 +1,45 @@
+#include "voice_queue.h"
+#include <string.h>
+
+#define QUEUE_LEN CONFIG_VOICE_QUEUE_LENGTH
+
+void voice_queue_init(voice_queue_t *queue)
+{
+    memset(queue->items, 0, sizeof(queue->items));
+    atomic_store(&queue->head, 0);
+    atomic_store(&queue->tail, 0);
+    atomic_store(&queue->dropped, 0);
+}
+
+bool voice_queue_push(voice_queue_t *queue, const voice_delta_t *delta)
+{
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint32_t next = (head + 1) % QUEUE_LEN;
+
+    if (next == atomic_load_explicit(&queue->tail, memory_order_acquire)) {
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    queue->items[head] = *delta;
+    atomic_store_explicit(&queue->head, next, memory_order_release);
+    return true;
+}
+
+bool voice_queue_pop(voice_queue_t *queue, voice_delta_t *delta)
+{
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&queue->head, memory_order_acquire)) {
+        return false;
+    }
+
+    *delta = queue->items[tail];
+    atomic_store_explicit(&queue->tail, (tail + 1) % QUEUE_LEN, memory_order_release);
+    return true;
+}
+
+uint32_t voice_queue_take_dropped(voice_queue_t *queue)
+{
+    return atomic_exchange_explicit(&queue->dropped, 0, memory_order_relaxed);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VOICE_DELTA_MUTE      (1 << 0)
+#define VOICE_DELTA_SELF_MUTE (1 << 1)
+#define VOICE_DELTA_DEAF      (1 << 2)
+#define VOICE_DELTA_SELF_DEAF (1 << 3)
+#define VOICE_DELTA_SESSION   (1 << 7) // no user, marks the start of a new gateway session
+
+/**
+ * @brief Compact voice state change, as pushed by the Discord event handler
+ */
+typedef struct {
+    uint64_t guild_id;   // 0 if the event had none
+    uint64_t user_id;
+    uint64_t channel_id; // 0 if the user left voice
+    uint32_t stamp_us;   // low bits of esp_timer_get_time() when received
+    uint8_t flags;       // VOICE_DELTA_* bits
+} voice_delta_t;
+
+/**
+ * @brief Lock-free single-producer/single-consumer ring of voice deltas
+ *
+ * One slot is always kept free to tell a full ring from an empty one.
+ */
+typedef struct {
+    voice_delta_t items[CONFIG_VOICE_QUEUE_LENGTH];
+    _Atomic uint32_t head;    // next slot to write, owned by the producer
+    _Atomic uint32_t tail;    // next slot to read, owned by the consumer
+    _Atomic uint32_t dropped; // deltas rejected because the ring was full
+} voice_queue_t;
+
+/**
+ * @brief Reset the ring to empty
+ */
+void voice_queue_init(voice_queue_t *queue);
+
+/**
+ * @brief Push a delta, producer side only
+ *
+ * @return false if the ring was full and the delta was dropped
+ */
+bool voice_queue_push(voice_queue_t *queue, const voice_delta_t *delta);
+
+/**
+ * @brief Pop the oldest delta, consumer side only
+ *
+ * @return false if the ring was empty
+ */
+bool voice_queue_pop(voice_queue_t *queue, voice_delta_t *delta);
+
+/**
+ * @brief Read and reset the dropped counter, consumer side only
+ */
+uint32_t voice_queue_take_dropped(voice_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
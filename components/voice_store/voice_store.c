@@ -0,0 +1,468 @@
+#include "voice_store.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if CONFIG_VOICE_STORE_RTC_BACKUP
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#endif
+
+#define VOICE_STORE_SLOTS    CONFIG_VOICE_STORE_CAPACITY
+#define VOICE_STORE_MAX_LOAD (VOICE_STORE_SLOTS * 3 / 4)
+#define CHANNEL_INDEX_SLOTS  CONFIG_VOICE_STORE_MAX_CHANNELS
+#define GUILD_INDEX_SLOTS    CONFIG_VOICE_STORE_MAX_GUILDS
+
+// Guild keys carry a marker bit so guild 0 (no guild given) still differs
+// from a free slot. Snowflakes will not reach bit 63 for another century.
+#define GUILD_KEY(id) ((id) | (1ULL << 63))
+
+// Set on an entry's channel id when the channel index was full as the user
+// joined. The channel's count never included the user, so leaving must not
+// take them off it either.
+#define CHANNEL_UNINDEXED (1ULL << 63)
+#define CHANNEL_ID(stored) ((stored) & ~CHANNEL_UNINDEXED)
+
+// A slot is free when user_id is 0, snowflakes are never 0
+typedef struct {
+    uint64_t guild_id;
+    uint64_t user_id;
+    uint64_t channel_id;
+} voice_entry_t;
+
+// Per-channel occupancy. Slots are claimed on first join and keep their id
+// while empty, so probe chains never break under lock-free readers. An
+// empty slot is handed to the next channel that needs one.
+typedef struct {
+    _Atomic uint64_t channel_id;
+    _Atomic uint32_t count;
+} channel_slot_t;
+
+// Per-guild occupancy, plus the source whose session reports the guild
+typedef struct {
+    _Atomic uint64_t key; // GUILD_KEY(guild_id), 0 if free
+    _Atomic uint32_t count;
+    uint8_t source;
+} guild_slot_t;
+
+typedef struct {
+    voice_entry_t slots[VOICE_STORE_SLOTS];
+    size_t count;
+    channel_slot_t channels[CHANNEL_INDEX_SLOTS];
+    guild_slot_t guilds[GUILD_INDEX_SLOTS];
+    _Atomic uint32_t total;
+} voice_table_t;
+
+// Readers use the active table. The writer updates s_write, which is the
+// active table except while a snapshot is being rebuilt next to it.
+static voice_table_t s_tables[2];
+static _Atomic(voice_table_t *) s_active = &s_tables[0];
+static voice_table_t *s_write = &s_tables[0];
+
+#if CONFIG_VOICE_STORE_RTC_BACKUP
+#define BACKUP_MAGIC   0x56535442 // "VSTB"
+#define BACKUP_ENTRIES CONFIG_VOICE_STORE_RTC_ENTRIES
+
+// Compact copy of one table: only occupied slots, and the guild index
+// without counts, those follow from the entries
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;  // everything from size up to the last used entry
+    uint32_t size; // sizeof(voice_backup_t), rejects copies from other builds
+    uint32_t entry_count;
+    struct {
+        uint64_t key;
+        uint8_t source;
+    } guilds[GUILD_INDEX_SLOTS];
+    voice_entry_t entries[BACKUP_ENTRIES];
+} voice_backup_t;
+
+// Left alone by the startup code, so it still holds the previous boot's copy
+static RTC_NOINIT_ATTR voice_backup_t s_backup;
+#endif
+
+// ================== Internal helpers ==================
+
+static size_t hash_snowflake(uint64_t id)
+{
+    // Fibonacci hashing, snowflakes share their low timestamp bits
+    return (size_t)((id * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static size_t home_slot(uint64_t guild_id, uint64_t user_id)
+{
+    return hash_snowflake(user_id ^ (guild_id * 0xC2B2AE3D27D4EB4FULL)) % VOICE_STORE_SLOTS;
+}
+
+// Returns the index slot for channel_id, claiming a free or empty one if
+// asked to. The whole chain is probed first, so a channel never gets two.
+static channel_slot_t *find_channel(voice_table_t *table, uint64_t channel_id, bool claim)
+{
+    channel_slot_t *empty = NULL;
+    size_t i = hash_snowflake(channel_id) % CHANNEL_INDEX_SLOTS;
+    for (size_t n = 0; n < CHANNEL_INDEX_SLOTS; n++) {
+        channel_slot_t *slot = &table->channels[i];
+        uint64_t id = atomic_load_explicit(&slot->channel_id, memory_order_acquire);
+        if (id == channel_id) return slot;
+        if (id == 0) {
+            if (!empty) empty = slot;
+            break;
+        }
+        if (!empty && atomic_load_explicit(&slot->count, memory_order_relaxed) == 0) empty = slot;
+        i = (i + 1) % CHANNEL_INDEX_SLOTS;
+    }
+    if (!claim || !empty) return NULL; // index full, channel is only reflected in the total
+
+    atomic_store_explicit(&empty->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&empty->channel_id, channel_id, memory_order_release);
+    return empty;
+}
+
+// Only the writer task changes counts, so load+store is enough here. The
+// store is a release so readers that see the count also see the slot's id.
+// Returns the channel id to keep in the user's entry.
+static uint64_t channel_join(voice_table_t *table, uint64_t channel_id)
+{
+    channel_slot_t *slot = find_channel(table, channel_id, true);
+    if (!slot) return channel_id | CHANNEL_UNINDEXED; // only reflected in the total
+    uint32_t count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+    atomic_store_explicit(&slot->count, count + 1, memory_order_release);
+    return channel_id;
+}
+
+// Takes a user off the channel, given the channel id kept in their entry
+static void channel_leave(voice_table_t *table, uint64_t stored)
+{
+    if (stored & CHANNEL_UNINDEXED) return;
+    channel_slot_t *slot = find_channel(table, stored, false);
+    if (!slot) return;
+    uint32_t count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+    atomic_store_explicit(&slot->count, count - 1, memory_order_release);
+}
+
+// Same as find_channel() for the guild index. A claimed slot belongs to
+// the given source, an empty one can be handed to another guild since no
+// entries are left to drop with it.
+static guild_slot_t *find_guild(voice_table_t *table, uint64_t guild_id, bool claim, uint8_t source)
+{
+    guild_slot_t *empty = NULL;
+    uint64_t key = GUILD_KEY(guild_id);
+    size_t i = hash_snowflake(key) % GUILD_INDEX_SLOTS;
+    for (size_t n = 0; n < GUILD_INDEX_SLOTS; n++) {
+        guild_slot_t *slot = &table->guilds[i];
+        uint64_t id = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if (id == key) return slot;
+        if (id == 0) {
+            if (!empty) empty = slot;
+            break;
+        }
+        if (!empty && atomic_load_explicit(&slot->count, memory_order_relaxed) == 0) empty = slot;
+        i = (i + 1) % GUILD_INDEX_SLOTS;
+    }
+    if (!claim || !empty) return NULL;
+
+    empty->source = source;
+    atomic_store_explicit(&empty->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&empty->key, key, memory_order_release);
+    return empty;
+}
+
+static void guild_adjust(guild_slot_t *slot, int delta)
+{
+    uint32_t count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+    atomic_store_explicit(&slot->count, count + delta, memory_order_release);
+}
+
+// Returns the slot holding the user's state in a guild, or the free slot
+// ending its probe chain
+static size_t find_slot(const voice_table_t *table, uint64_t guild_id, uint64_t user_id)
+{
+    size_t i = home_slot(guild_id, user_id);
+    while (table->slots[i].user_id != 0 &&
+           (table->slots[i].user_id != user_id || table->slots[i].guild_id != guild_id)) {
+        i = (i + 1) % VOICE_STORE_SLOTS;
+    }
+    return i;
+}
+
+// Backward-shift deletion, keeps probe chains intact without tombstones
+static void remove_slot(voice_table_t *table, size_t i)
+{
+    size_t j = i;
+    while (1) {
+        j = (j + 1) % VOICE_STORE_SLOTS;
+        if (table->slots[j].user_id == 0) {
+            break;
+        }
+        size_t k = home_slot(table->slots[j].guild_id, table->slots[j].user_id);
+        bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            table->slots[i] = table->slots[j];
+            i = j;
+        }
+    }
+    table->slots[i].guild_id = 0;
+    table->slots[i].user_id = 0;
+    table->slots[i].channel_id = 0;
+    table->count--;
+}
+
+// Guild owners saved before a rebuild clears the index they live in
+typedef struct {
+    uint64_t key;
+    uint8_t source;
+} guild_owner_t;
+
+static guild_owner_t s_owners[GUILD_INDEX_SLOTS];
+
+static int owner_of(size_t owner_count, uint64_t guild_id)
+{
+    uint64_t key = GUILD_KEY(guild_id);
+    for (size_t i = 0; i < owner_count; i++) {
+        if (s_owners[i].key == key) return s_owners[i].source;
+    }
+    return -1;
+}
+
+// Fill dst with the entries of src minus the guilds of one source, and
+// build both indexes again from what is left. Empty channel and guild
+// slots are not carried over, guilds keep the source that reported them.
+// src may be dst. dst may still be probed by readers, so the indexes are
+// cleared with atomic stores rather than memset.
+static void table_rebuild(voice_table_t *dst, const voice_table_t *src, uint8_t drop_source)
+{
+    size_t owner_count = 0;
+    for (size_t i = 0; i < GUILD_INDEX_SLOTS; i++) {
+        uint64_t key = atomic_load_explicit(&src->guilds[i].key, memory_order_relaxed);
+        if (key == 0 || atomic_load_explicit(&src->guilds[i].count, memory_order_relaxed) == 0) continue;
+        s_owners[owner_count].key = key;
+        s_owners[owner_count].source = src->guilds[i].source;
+        owner_count++;
+    }
+
+    if (dst != src) {
+        memcpy(dst->slots, src->slots, sizeof(dst->slots));
+        dst->count = src->count;
+    }
+    for (size_t i = 0; i < CHANNEL_INDEX_SLOTS; i++) {
+        atomic_store_explicit(&dst->channels[i].channel_id, 0, memory_order_relaxed);
+        atomic_store_explicit(&dst->channels[i].count, 0, memory_order_relaxed);
+    }
+    for (size_t i = 0; i < GUILD_INDEX_SLOTS; i++) {
+        atomic_store_explicit(&dst->guilds[i].key, 0, memory_order_relaxed);
+        atomic_store_explicit(&dst->guilds[i].count, 0, memory_order_relaxed);
+    }
+
+    // Drop first: the backward shift can wrap entries from the start of the
+    // table into slot i, which a counting pass would then see twice
+    size_t i = 0;
+    while (i < VOICE_STORE_SLOTS) {
+        const voice_entry_t *entry = &dst->slots[i];
+        int owner = owner_of(owner_count, entry->guild_id);
+        if (entry->user_id == 0 || (owner >= 0 && owner != drop_source)) {
+            i++;
+            continue;
+        }
+        // The backward shift may move another entry into slot i
+        remove_slot(dst, i);
+    }
+
+    // Channels that did not fit before may get a slot now
+    for (i = 0; i < VOICE_STORE_SLOTS; i++) {
+        voice_entry_t *entry = &dst->slots[i];
+        if (entry->user_id == 0) continue;
+        guild_slot_t *guild = find_guild(dst, entry->guild_id, true, (uint8_t)owner_of(owner_count, entry->guild_id));
+        if (guild) guild_adjust(guild, 1);
+        entry->channel_id = channel_join(dst, CHANNEL_ID(entry->channel_id));
+    }
+    atomic_store_explicit(&dst->total, dst->count, memory_order_relaxed);
+}
+
+// ================== Public API ==================
+
+uint64_t voice_store_parse_snowflake(const char *str)
+{
+    if (!str || !*str) return 0;
+
+    uint64_t value = 0;
+    for (const char *p = str; *p; p++) {
+        if (*p < '0' || *p > '9') return 0;
+        uint64_t digit = (uint64_t)(*p - '0');
+        if (value > (UINT64_MAX - digit) / 10) return 0; // overflow
+        value = value * 10 + digit;
+    }
+    return value;
+}
+
+void voice_store_init(void)
+{
+    memset(s_tables, 0, sizeof(s_tables));
+    s_write = &s_tables[0];
+    atomic_store_explicit(&s_active, s_write, memory_order_release);
+}
+
+#if CONFIG_VOICE_STORE_RTC_BACKUP
+static uint32_t backup_crc(const voice_backup_t *backup)
+{
+    const uint8_t *start = (const uint8_t *)&backup->size;
+    const uint8_t *end = (const uint8_t *)&backup->entries[backup->entry_count];
+    return esp_rom_crc32_le(0, start, (uint32_t)(end - start));
+}
+
+void voice_store_backup(void)
+{
+    const voice_table_t *table = atomic_load_explicit(&s_active, memory_order_relaxed);
+
+    // Invalid while being written, a reset halfway leaves no torn copy
+    s_backup.magic = 0;
+    s_backup.size = sizeof(s_backup);
+    for (size_t i = 0; i < GUILD_INDEX_SLOTS; i++) {
+        s_backup.guilds[i].key = atomic_load_explicit(&table->guilds[i].key, memory_order_relaxed);
+        s_backup.guilds[i].source = table->guilds[i].source;
+    }
+    uint32_t n = 0;
+    for (size_t i = 0; i < VOICE_STORE_SLOTS && n < BACKUP_ENTRIES; i++) {
+        if (table->slots[i].user_id != 0) s_backup.entries[n++] = table->slots[i];
+    }
+    s_backup.entry_count = n;
+    s_backup.crc = backup_crc(&s_backup);
+    s_backup.magic = BACKUP_MAGIC;
+}
+
+bool voice_store_restore(uint8_t source_count)
+{
+    if (s_backup.magic != BACKUP_MAGIC || s_backup.size != sizeof(s_backup) ||
+        s_backup.entry_count > BACKUP_ENTRIES || s_backup.crc != backup_crc(&s_backup)) {
+        return false;
+    }
+
+    // Every entry is stored under the source its guild was reported by
+    for (uint32_t i = 0; i < s_backup.entry_count; i++) {
+        const voice_entry_t *entry = &s_backup.entries[i];
+        for (size_t g = 0; g < GUILD_INDEX_SLOTS; g++) {
+            if (s_backup.guilds[g].key != GUILD_KEY(entry->guild_id)) continue;
+            if (s_backup.guilds[g].source < source_count) {
+                voice_store_update(s_backup.guilds[g].source, entry->guild_id, entry->user_id,
+                                   CHANNEL_ID(entry->channel_id));
+            }
+            break;
+        }
+    }
+    return true;
+}
+#else
+void voice_store_backup(void)
+{
+}
+
+bool voice_store_restore(uint8_t source_count)
+{
+    return false;
+}
+#endif
+
+void voice_store_snapshot_begin(uint8_t source)
+{
+    // Other sources' guilds are carried over, including changes already
+    // staged by a rebuild that is still pending
+    voice_table_t *src = s_write;
+    if (!voice_store_snapshot_pending()) {
+        voice_table_t *active = atomic_load_explicit(&s_active, memory_order_relaxed);
+        s_write = (active == &s_tables[0]) ? &s_tables[1] : &s_tables[0];
+        src = active;
+    }
+    table_rebuild(s_write, src, source);
+}
+
+void voice_store_snapshot_commit(void)
+{
+    // Release orders every write to the new table before the swap
+    atomic_store_explicit(&s_active, s_write, memory_order_release);
+}
+
+bool voice_store_snapshot_pending(void)
+{
+    return s_write != atomic_load_explicit(&s_active, memory_order_relaxed);
+}
+
+voice_store_result_t voice_store_update(uint8_t source, uint64_t guild_id, uint64_t user_id, uint64_t channel_id)
+{
+    if (user_id == 0) return VOICE_STORE_UNCHANGED;
+
+    voice_table_t *table = s_write;
+    size_t i = find_slot(table, guild_id, user_id);
+    voice_entry_t *entry = &table->slots[i];
+
+    if (entry->user_id == 0) {
+        // User was not in voice
+        if (channel_id == 0) return VOICE_STORE_UNCHANGED;
+        if (table->count >= VOICE_STORE_MAX_LOAD) return VOICE_STORE_FULL;
+
+        // A user whose guild cannot be indexed could never be dropped
+        // with its source, so it is not stored at all
+        guild_slot_t *guild = find_guild(table, guild_id, true, source);
+        if (!guild) return VOICE_STORE_FULL;
+
+        entry->guild_id = guild_id;
+        entry->user_id = user_id;
+        entry->channel_id = channel_join(table, channel_id);
+        table->count++;
+        guild_adjust(guild, 1);
+        atomic_store_explicit(&table->total, table->count, memory_order_relaxed);
+        return VOICE_STORE_JOINED;
+    }
+
+    if (channel_id == 0) {
+        channel_leave(table, entry->channel_id);
+        guild_adjust(find_guild(table, guild_id, false, 0), -1);
+        remove_slot(table, i);
+        atomic_store_explicit(&table->total, table->count, memory_order_relaxed);
+        return VOICE_STORE_LEFT;
+    }
+
+    if (CHANNEL_ID(entry->channel_id) == channel_id) return VOICE_STORE_UNCHANGED;
+
+    channel_leave(table, entry->channel_id);
+    entry->channel_id = channel_join(table, channel_id);
+    return VOICE_STORE_MOVED;
+}
+
+size_t voice_store_total_count(void)
+{
+    voice_table_t *table = atomic_load_explicit(&s_active, memory_order_acquire);
+    return atomic_load_explicit(&table->total, memory_order_relaxed);
+}
+
+size_t voice_store_channel_count(uint64_t channel_id)
+{
+    if (channel_id == 0) return 0;
+
+    voice_table_t *table = atomic_load_explicit(&s_active, memory_order_acquire);
+    channel_slot_t *slot = find_channel(table, channel_id, false);
+    if (!slot) return 0;
+
+    // An empty slot may have been handed to another channel meanwhile
+    uint32_t count = atomic_load_explicit(&slot->count, memory_order_acquire);
+    if (atomic_load_explicit(&slot->channel_id, memory_order_relaxed) != channel_id) return 0;
+    return count;
+}
+
+size_t voice_store_guild_count(uint64_t guild_id)
+{
+    voice_table_t *table = atomic_load_explicit(&s_active, memory_order_acquire);
+    guild_slot_t *slot = find_guild(table, guild_id, false, 0);
+    if (!slot) return 0;
+
+    // Same check as voice_store_channel_count()
+    uint32_t count = atomic_load_explicit(&slot->count, memory_order_acquire);
+    if (atomic_load_explicit(&slot->key, memory_order_relaxed) != GUILD_KEY(guild_id)) return 0;
+    return count;
+}
+
+uint64_t voice_store_user_channel(uint64_t guild_id, uint64_t user_id)
+{
+    if (user_id == 0) return 0;
+
+    return CHANNEL_ID(s_write->slots[find_slot(s_write, guild_id, user_id)].channel_id);
+}
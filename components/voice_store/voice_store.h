@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Outcome of a voice state update
+ */
+typedef enum {
+    VOICE_STORE_UNCHANGED = 0, // User stayed where they were (mute, deaf, ...)
+    VOICE_STORE_JOINED,        // User was not in voice and joined a channel
+    VOICE_STORE_LEFT,          // User left voice, their slot was freed
+    VOICE_STORE_MOVED,         // User moved from one channel to another
+    VOICE_STORE_FULL,          // User joined but the table or guild index is full
+} voice_store_result_t;
+
+/**
+ * @brief Parse a Discord snowflake string into its numeric form
+ *
+ * @return The snowflake, or 0 if the string is NULL or not a valid snowflake
+ */
+uint64_t voice_store_parse_snowflake(const char *str);
+
+/**
+ * @brief Clear all tracked voice states and channel counts
+ */
+void voice_store_init(void);
+
+/**
+ * @brief Start rebuilding the guilds of one source from scratch
+ *
+ * Later updates go to a table next to the current one, holding everything
+ * except the users in guilds first reported by this source, while the
+ * counts keep reporting the current table until
+ * voice_store_snapshot_commit(). Calling it again while a rebuild is
+ * pending drops that source's guilds from the rebuild, so sessions of
+ * several sources can restart at the same time. Writer task only.
+ *
+ * @param source Index of the bot whose session restarted
+ */
+void voice_store_snapshot_begin(uint8_t source);
+
+/**
+ * @brief Make the rebuilt table the current one, in a single atomic swap
+ */
+void voice_store_snapshot_commit(void);
+
+/**
+ * @brief True between voice_store_snapshot_begin() and the commit
+ */
+bool voice_store_snapshot_pending(void);
+
+/**
+ * @brief Record the voice channel a user is in within a guild
+ *
+ * The same user in two guilds is tracked as two independent entries.
+ *
+ * @param source     Bot that reported the update, owns the guild from its
+ *                   first update until the table is rebuilt
+ * @param guild_id   Numeric guild snowflake, 0 if the event had none
+ * @param user_id    Numeric user snowflake, must not be 0
+ * @param channel_id Numeric channel snowflake, or 0 if the user left voice
+ */
+voice_store_result_t voice_store_update(uint8_t source, uint64_t guild_id, uint64_t user_id, uint64_t channel_id);
+
+/**
+ * @brief Copy the current table to RTC memory, guarded by a checksum
+ *
+ * Cheap enough to call after every batch of updates. Does nothing unless
+ * CONFIG_VOICE_STORE_RTC_BACKUP is set. Writer task only.
+ */
+void voice_store_backup(void);
+
+/**
+ * @brief Load the table saved by voice_store_backup() before a reset
+ *
+ * Call right after voice_store_init(), and only after a reset that keeps
+ * RTC memory. A copy with a bad checksum or from a build with another
+ * layout is ignored. Restored guilds keep their source, so each source's
+ * next voice_store_snapshot_begin() replaces them with fresh state.
+ *
+ * @param source_count Number of sources now running, guilds of sources
+ *                     that no longer exist are dropped
+ * @return True if a saved copy was loaded, even one with nobody in voice
+ */
+bool voice_store_restore(uint8_t source_count);
+
+/**
+ * @brief Number of users currently in any voice channel
+ *
+ * Lock-free, safe to call from any task.
+ */
+size_t voice_store_total_count(void);
+
+/**
+ * @brief Number of users currently in the given voice channel
+ *
+ * Lock-free, safe to call from any task.
+ */
+size_t voice_store_channel_count(uint64_t channel_id);
+
+/**
+ * @brief Number of users currently in voice in the given guild
+ *
+ * Lock-free, safe to call from any task.
+ */
+size_t voice_store_guild_count(uint64_t guild_id);
+
+/**
+ * @brief Channel a user is currently in within a guild, or 0 if not in voice
+ *
+ * Reads the table being written, which is the rebuilt one during a
+ * snapshot, so only call this from the task doing the updates.
+ */
+uint64_t voice_store_user_channel(uint64_t guild_id, uint64_t user_id);
+
+#ifdef __cplusplus
+}
+#endif
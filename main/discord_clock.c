@@ -6,9 +6,21 @@
 #include "esp_system.h"
 #include "esp_http_server.h"
 #include "string.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "stdint.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_bit_defs.h"
+#include "esp_random.h"
+#include "esp_mac.h"
+#include "nvs.h"
+#include "sys/param.h"
 #include "mdns.h"
+#if CONFIG_POWER_SAVE_IDLE
+#include "esp_pm.h"
+#endif
 
 #include "driver/gpio.h"
 #include "discord.h"
@@ -20,9 +32,26 @@
 #include "config_portal.h"
 
 #include "led_animation.h"
+#include "led_effects.h"
+#include "led_framebuffer.h"
 
+#include "voice_store.h"
+#include "voice_queue.h"
 
-static discord_handle_t bot;
+#include "metrics.h"
+#if CONFIG_BENCHMARK_ENABLE
+#include "benchmark.h"
+#endif
+
+
+// Several bots can feed the same store, e.g. for guilds that each only
+// allow their own bot. The index is the source tag in the voice store.
+#define DISCORD_MAX_BOTS 3
+#define DISCORD_TOKEN_MAX 96
+
+static discord_handle_t bots[DISCORD_MAX_BOTS];
+static char bot_tokens[DISCORD_MAX_BOTS][DISCORD_TOKEN_MAX];
+static int bot_count = 0;
 static const char *TAG = "discord_clock";
 
 
@@ -32,6 +61,64 @@ void start_sta(const char* ssid, const char* pass);
 void wifi_event_handler(void* arg, esp_event_base_t event_base,
                         int32_t event_id, void* event_data);
 void connection_success_callback(void);
+static void power_set_idle(bool idle);
+static void power_apply(void);
+
+
+// ======= BOOT TIMING =======
+// esp_timer counts from power-up, so every stage is logged as start time
+// and duration in microseconds since boot
+
+typedef enum {
+    BOOT_SETTINGS,
+    BOOT_LEDS,
+    BOOT_NETIF,
+    BOOT_WIFI_INIT,
+    BOOT_SERVICES, // mDNS + portal, runs next to BOOT_WIFI_INIT
+    BOOT_WIFI_START,
+    BOOT_GOT_IP,
+    BOOT_DISCORD,
+    BOOT_STAGE_COUNT,
+} boot_stage_t;
+
+static const char* boot_stage_names[BOOT_STAGE_COUNT] = {
+    [BOOT_SETTINGS] = "settings",
+    [BOOT_LEDS] = "leds",
+    [BOOT_NETIF] = "netif",
+    [BOOT_WIFI_INIT] = "wifi init",
+    [BOOT_SERVICES] = "mdns+portal",
+    [BOOT_WIFI_START] = "wifi start",
+    [BOOT_GOT_IP] = "got ip",
+    [BOOT_DISCORD] = "discord",
+};
+
+static int64_t boot_stage_start_us[BOOT_STAGE_COUNT];
+static int64_t boot_stage_end_us[BOOT_STAGE_COUNT];
+
+static void boot_stage_begin(boot_stage_t stage) {
+    boot_stage_start_us[stage] = esp_timer_get_time();
+}
+
+static void boot_stage_end(boot_stage_t stage) {
+    boot_stage_end_us[stage] = esp_timer_get_time();
+}
+
+static void boot_log_timing(void) {
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        if (boot_stage_end_us[i] == 0) continue;
+        ESP_LOGI(TAG, "boot: %-12s at %8lld us, took %8lld us", boot_stage_names[i],
+                 (long long)boot_stage_start_us[i],
+                 (long long)(boot_stage_end_us[i] - boot_stage_start_us[i]));
+    }
+
+#if CONFIG_METRICS_HEAP_COUNTS
+    // Everything after this is steady state, /metrics shows what it adds
+    uint32_t allocs, frees;
+    metrics_heap_counts(&allocs, &frees);
+    ESP_LOGI(TAG, "boot: %u heap allocations, %u frees, %u blocks still allocated",
+             (unsigned)allocs, (unsigned)frees, (unsigned)(allocs - frees));
+#endif
+}
 
 
 /* DISCORD CODE */
@@ -42,111 +129,480 @@ void connection_success_callback(void);
  */
 const gpio_num_t LED_GPIO = GPIO_NUM_2;
 
-typedef struct user_voice_state {
-    char user_id[64];    // Store user ID
-    char channel_id[64]; // Store channel ID (if in a voice channel)
-    struct user_voice_state* next;
-} user_voice_state_t;
-
-static user_voice_state_t* voice_states_head = NULL; // Linked list head for tracking voice states
-static int voice_channel_user_count = 0;            // Global counter for users in voice chat
-
-// Add or update a user's voice state
-void update_user_voice_state(const char* user_id, const char* channel_id) {
-    user_voice_state_t* current = voice_states_head;
-    user_voice_state_t* prev = NULL;
-
-    // Search for the user in the linked list
-    while (current != NULL) {
-        if (strcmp(current->user_id, user_id) == 0) {
-            // User found
-            if (channel_id == NULL && current->channel_id[0] != '\0') {
-                // User left a voice channel
-                voice_channel_user_count--;
-                ESP_LOGI(TAG, "User %s left voice chat. Count: %d", user_id, voice_channel_user_count);
-            } else if (channel_id != NULL && current->channel_id[0] == '\0') {
-                // User joined a voice channel
-                voice_channel_user_count++;
-                ESP_LOGI(TAG, "User %s joined voice chat. Count: %d", user_id, voice_channel_user_count);
-            }
+#define VOICE_TASK_STACK 4096
+#define BOOT_SERVICES_STACK 4096
+
+// Notification bits for the voice task
+#define VOICE_NOTIFY_DELTAS BIT0 // deltas were queued
+#define VOICE_NOTIFY_OUTPUT BIT1 // debounce/hold-off timer expired
+#define VOICE_NOTIFY_SNAPSHOT BIT2 // snapshot went quiet, time to swap it in
+#define VOICE_NOTIFY_RESTORE  BIT3 // state restored at boot ran out
+
+// A snapshot that never goes quiet is committed after this long anyway
+#define VOICE_SNAPSHOT_MAX_MS (10 * CONFIG_VOICE_SNAPSHOT_QUIET_MS)
+
+// State restored from RTC memory is dropped if its bot has not sent a
+// snapshot by then. Counted from boot, not from Wi-Fi coming up: wrong
+// credentials saved just before the reset never bring it up.
+#define VOICE_RESTORE_MAX_MS (6 * VOICE_SNAPSHOT_MAX_MS)
+
+// Shown from power-up until the voice state is known
+#define BOOT_ANIMATION LED_ANIM_BREATHE
+
+// One queue per bot, every bot's event handler is its own producer
+static voice_queue_t voice_queues[DISCORD_MAX_BOTS];
+static TaskHandle_t voice_task_handle = NULL;
+static StackType_t voice_task_stack[VOICE_TASK_STACK];
+static StaticTask_t voice_task_buf;
+static esp_timer_handle_t output_timer = NULL;
+static esp_timer_handle_t snapshot_timer = NULL;
+static esp_timer_handle_t restore_timer = NULL;
+static int64_t snapshot_start_us = 0;
+static uint32_t snapshot_sources = 0; // bit per bot rebuilding its guilds
+static uint32_t restored_sources = 0; // bit per bot still showing restored state
+
+METRICS_COUNTER(events_processed, "discord_voice_events_processed_total",
+                "Voice state updates applied to the store");
+METRICS_COUNTER(events_dropped, "discord_voice_events_dropped_total",
+                "Voice state updates lost because the queue was full");
+METRICS_COUNTER(events_filtered, "discord_voice_events_filtered_total",
+                "Voice state updates for guilds outside the allow-list");
+METRICS_HISTOGRAM(event_latency, "discord_event_to_led_us",
+                  "Delay from the oldest voice update of a batch to the LED update it caused",
+                  500, 1000, 5000, 10000, 50000, 100000, 250000, 500000,
+                  1000000, 2500000, 5000000, 10000000);
+
+// Receive time of the oldest delta not yet shown on the outputs
+static uint32_t latency_start_us = 0;
+static bool latency_pending = false;
+
+// Channels whose occupancy changed since the outputs were last applied
+#define DIRTY_CHANNELS_MAX 8
+static struct {
+    uint64_t guild_id;
+    uint64_t channel_id;
+} dirty_channels[DIRTY_CHANNELS_MAX];
+static int dirty_channel_count = 0;
+static bool dirty_all_channels = false;
+
+static void mark_channel_dirty(uint64_t guild_id, uint64_t channel_id) {
+    for (int i = 0; i < dirty_channel_count; i++) {
+        if (dirty_channels[i].guild_id == guild_id && dirty_channels[i].channel_id == channel_id) return;
+    }
+    if (dirty_channel_count < DIRTY_CHANNELS_MAX) {
+        dirty_channels[dirty_channel_count].guild_id = guild_id;
+        dirty_channels[dirty_channel_count].channel_id = channel_id;
+        dirty_channel_count++;
+    } else {
+        dirty_all_channels = true;
+    }
+}
 
-            // Update the user's channel ID
-            if (channel_id) {
-                strncpy(current->channel_id, channel_id, sizeof(current->channel_id) - 1);
-                current->channel_id[sizeof(current->channel_id) - 1] = '\0'; // Null-terminate
-            } else {
-                current->channel_id[0] = '\0'; // Clear channel ID
-            }
-            return;
+// Level source for the LED segments, lock-free reads of the voice store
+static uint16_t voice_level(uint64_t guild_id, uint64_t channel_id) {
+    size_t count = channel_id ? voice_store_channel_count(channel_id)
+                 : guild_id   ? voice_store_guild_count(guild_id)
+                              : voice_store_total_count();
+    return count > UINT16_MAX ? UINT16_MAX : (uint16_t)count;
+}
+
+// Guilds whose events are used, read once at boot. Empty accepts every guild.
+static char allowed_guilds[CONFIG_VOICE_STORE_MAX_GUILDS][21];
+static int allowed_guild_count = 0;
+
+static void load_guild_allow_list(void) {
+    settings_t settings;
+    settings_get(&settings);
+
+    char* save = NULL;
+    for (char* tok = strtok_r(settings.guilds, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (voice_store_parse_snowflake(tok) == 0 || strlen(tok) >= sizeof(allowed_guilds[0])) {
+            ESP_LOGW(TAG, "Ignoring invalid guild '%s'", tok);
+        } else if (allowed_guild_count == CONFIG_VOICE_STORE_MAX_GUILDS) {
+            ESP_LOGW(TAG, "More than %d guilds listed, ignoring '%s'", CONFIG_VOICE_STORE_MAX_GUILDS, tok);
+        } else {
+            strcpy(allowed_guilds[allowed_guild_count++], tok);
         }
-        prev = current;
-        current = current->next;
-    }
-
-    // User not found: Add new user to the list
-    user_voice_state_t* new_user = (user_voice_state_t*)malloc(sizeof(user_voice_state_t));
-    if (!new_user) {
-        ESP_LOGE(TAG, "Failed to allocate memory for new user");
-        return;
-    }
-    strncpy(new_user->user_id, user_id, sizeof(new_user->user_id) - 1);
-    new_user->user_id[sizeof(new_user->user_id) - 1] = '\0'; // Null-terminate
-    if (channel_id) {
-        strncpy(new_user->channel_id, channel_id, sizeof(new_user->channel_id) - 1);
-        new_user->channel_id[sizeof(new_user->channel_id) - 1] = '\0'; // Null-terminate
-        voice_channel_user_count++;
-        ESP_LOGI(TAG, "User %s joined voice chat for the first time. Count: %d", user_id, voice_channel_user_count);
+    }
+    if (allowed_guild_count) {
+        ESP_LOGI(TAG, "Following %d guilds", allowed_guild_count);
+    }
+}
+
+// Compares the raw id string, so filtered events cost no parsing
+static bool guild_allowed(const char* guild_id) {
+    if (allowed_guild_count == 0) return true;
+    if (!guild_id) return false;
+    for (int i = 0; i < allowed_guild_count; i++) {
+        if (strcmp(allowed_guilds[i], guild_id) == 0) return true;
+    }
+    return false;
+}
+static bool output_lit = false;
+
+// Debounce deadline: a guild that never goes quiet still gets its outputs
+// applied at this interval
+#define VOICE_DEBOUNCE_MAX_WAIT_MS (4 * CONFIG_VOICE_DEBOUNCE_MS)
+static int64_t outputs_pending_since_us = 0; // 0 while nothing waits
+
+// Push one voice change to the portal's WebSocket clients
+static void publish_voice_event(const char* event, uint64_t guild_id, uint64_t user_id, uint64_t channel_id) {
+    if (!config_portal_has_listeners()) return;
+
+    // Snowflakes are sent as strings, they do not fit in a JS number
+    char json[224];
+    snprintf(json, sizeof(json),
+             "{\"type\":\"voice\",\"event\":\"%s\",\"guild\":\"%llu\",\"user\":\"%llu\",\"channel\":\"%llu\","
+             "\"channel_users\":%d,\"guild_users\":%d,\"users\":%d}",
+             event, (unsigned long long)guild_id, (unsigned long long)user_id, (unsigned long long)channel_id,
+             (int)voice_store_channel_count(channel_id), (int)voice_store_guild_count(guild_id),
+             (int)voice_store_total_count());
+    config_portal_publish(json, false);
+}
+
+// Push the output state, retained so new clients start from it
+static void publish_state(led_animation_type_t anim) {
+    char json[96];
+    snprintf(json, sizeof(json), "{\"type\":\"state\",\"users\":%d,\"lit\":%s,\"animation\":\"%s\"}",
+             (int)voice_store_total_count(), output_lit ? "true" : "false", led_effect_get(anim)->name);
+    config_portal_publish(json, true);
+}
+
+// Apply one delta from a bot to the store and log what it changed.
+// Returns true if the occupancy changed, mute and deaf toggles do not count.
+static bool apply_voice_delta(uint8_t source, const voice_delta_t* delta) {
+    uint64_t guild_id = delta->guild_id;
+    uint64_t prev_channel_id = voice_store_user_channel(guild_id, delta->user_id);
+
+    ESP_LOGD(TAG, "voice_state (bot=%u, guild_id=%llu, user_id=%llu, channel_id=%llu, mute=%d, self_mute=%d, deaf=%d, self_deaf=%d)",
+             source,
+             (unsigned long long)guild_id,
+             (unsigned long long)delta->user_id,
+             (unsigned long long)delta->channel_id,
+             !!(delta->flags & VOICE_DELTA_MUTE),
+             !!(delta->flags & VOICE_DELTA_SELF_MUTE),
+             !!(delta->flags & VOICE_DELTA_DEAF),
+             !!(delta->flags & VOICE_DELTA_SELF_DEAF));
+
+    voice_store_result_t result = voice_store_update(source, guild_id, delta->user_id, delta->channel_id);
+    switch (result) {
+        case VOICE_STORE_JOINED:
+            ESP_LOGI(TAG, "User %llu joined channel %llu (%d here). Count: %d",
+                     (unsigned long long)delta->user_id, (unsigned long long)delta->channel_id,
+                     (int)voice_store_channel_count(delta->channel_id), (int)voice_store_total_count());
+            publish_voice_event("joined", guild_id, delta->user_id, delta->channel_id);
+            mark_channel_dirty(guild_id, delta->channel_id);
+            break;
+        case VOICE_STORE_LEFT:
+            ESP_LOGI(TAG, "User %llu left channel %llu (%d left). Count: %d",
+                     (unsigned long long)delta->user_id, (unsigned long long)prev_channel_id,
+                     (int)voice_store_channel_count(prev_channel_id), (int)voice_store_total_count());
+            publish_voice_event("left", guild_id, delta->user_id, prev_channel_id);
+            mark_channel_dirty(guild_id, prev_channel_id);
+            break;
+        case VOICE_STORE_MOVED:
+            ESP_LOGI(TAG, "User %llu moved from channel %llu (%d left) to %llu (%d here)",
+                     (unsigned long long)delta->user_id, (unsigned long long)prev_channel_id,
+                     (int)voice_store_channel_count(prev_channel_id), (unsigned long long)delta->channel_id,
+                     (int)voice_store_channel_count(delta->channel_id));
+            publish_voice_event("moved", guild_id, delta->user_id, delta->channel_id);
+            mark_channel_dirty(guild_id, prev_channel_id);
+            mark_channel_dirty(guild_id, delta->channel_id);
+            break;
+        case VOICE_STORE_FULL:
+            ESP_LOGE(TAG, "Voice state table full, ignoring user %llu in guild %llu",
+                     (unsigned long long)delta->user_id, (unsigned long long)guild_id);
+            break;
+        default:
+            break;
+    }
+    return result == VOICE_STORE_JOINED || result == VOICE_STORE_LEFT || result == VOICE_STORE_MOVED;
+}
+
+// Drive the strip, status LED and power mode from the current occupancy,
+// and keep a copy of it in RTC memory for the next boot
+static void apply_outputs(void) {
+    size_t count = voice_store_total_count();
+
+    // Level effects scale with the total, the strip is lit while anyone is in voice
+    led_animation_set_level(count, CONFIG_OCCUPANCY_FULL_USERS);
+    bool was_lit = output_lit;
+    output_lit = count > 0;
+    led_animation_type_t anim = output_lit ? LED_ANIM_SOLID : LED_ANIM_OFF;
+    led_animation_set(anim);
+    gpio_set_level(LED_GPIO, output_lit);  // LED on while anyone is in voice
+    power_set_idle(!output_lit);
+    voice_store_backup();
+
+    // Only the segments following a changed channel are drawn again
+    if (dirty_all_channels) {
+        led_animation_mark_channel(0, 0);
     } else {
-        new_user->channel_id[0] = '\0'; // No channel
+        for (int i = 0; i < dirty_channel_count; i++) {
+            led_animation_mark_channel(dirty_channels[i].guild_id, dirty_channels[i].channel_id);
+        }
+    }
+    dirty_channel_count = 0;
+    dirty_all_channels = false;
+    outputs_pending_since_us = 0;
+
+    // Includes the debounce or hold-off, that is what the user sees
+    if (latency_pending) {
+        metrics_histogram_observe(&event_latency, (uint32_t)esp_timer_get_time() - latency_start_us);
+        latency_pending = false;
     }
-    new_user->next = NULL;
 
-    // Append to the linked list
-    if (prev) {
-        prev->next = new_user;
+    static size_t published_count = SIZE_MAX;
+    if (count != published_count || output_lit != was_lit) {
+        published_count = count;
+        publish_state(anim);
+    }
+}
+
+// Wait for the occupancy to settle before touching the outputs, and keep
+// them lit for a while after the last user leaves
+static void schedule_outputs(void) {
+    bool occupied = voice_store_total_count() > 0;
+    uint32_t delay_ms = (!occupied && output_lit) ? CONFIG_VOICE_HOLD_OFF_MS
+                                                  : CONFIG_VOICE_DEBOUNCE_MS;
+
+    // The debounce trails each change but never waits past its deadline
+    int64_t now = esp_timer_get_time();
+    if (outputs_pending_since_us == 0) {
+        outputs_pending_since_us = now;
+    } else if (delay_ms == CONFIG_VOICE_DEBOUNCE_MS &&
+               now - outputs_pending_since_us >= (int64_t)VOICE_DEBOUNCE_MAX_WAIT_MS * 1000) {
+        delay_ms = 0;
+    }
+
+    esp_timer_stop(output_timer);
+    if (delay_ms == 0) {
+        apply_outputs();
     } else {
-        voice_states_head = new_user;
+        esp_timer_start_once(output_timer, (uint64_t)delay_ms * 1000);
+    }
+}
+
+static void output_timer_callback(void* arg) {
+    xTaskNotify(voice_task_handle, VOICE_NOTIFY_OUTPUT, eSetBits);
+}
+
+static void snapshot_timer_callback(void* arg) {
+    xTaskNotify(voice_task_handle, VOICE_NOTIFY_SNAPSHOT, eSetBits);
+}
+
+// A new gateway session replays every voice state of the guild. Rebuild the
+// store from that instead of patching the old one, which may have missed
+// leaves while we were disconnected.
+static void snapshot_start(uint8_t source) {
+    ESP_LOGI(TAG, "New session of bot %u, rebuilding its guilds from their snapshot", source);
+    voice_store_snapshot_begin(source);
+    snapshot_sources |= 1u << source;
+    snapshot_start_us = esp_timer_get_time();
+    esp_timer_stop(snapshot_timer);
+    esp_timer_start_once(snapshot_timer, (uint64_t)CONFIG_VOICE_SNAPSHOT_QUIET_MS * 1000);
+}
+
+// Push the commit out while the snapshot is still arriving
+static void snapshot_extend(void) {
+    if (esp_timer_get_time() - snapshot_start_us >= (int64_t)VOICE_SNAPSHOT_MAX_MS * 1000) return;
+    esp_timer_stop(snapshot_timer);
+    esp_timer_start_once(snapshot_timer, (uint64_t)CONFIG_VOICE_SNAPSHOT_QUIET_MS * 1000);
+}
+
+static void snapshot_finish(void) {
+    size_t before = voice_store_total_count();
+    voice_store_snapshot_commit();
+    restored_sources &= ~snapshot_sources;
+    snapshot_sources = 0;
+
+    // Segments start following their channels once the occupancy is known
+    dirty_all_channels = true;
+    led_animation_set_level_source(voice_level, CONFIG_OCCUPANCY_FULL_USERS);
+    ESP_LOGI(TAG, "Voice state rebuilt in %lld ms: %d users in voice (was %d)",
+             (long long)((esp_timer_get_time() - snapshot_start_us) / 1000),
+             (int)voice_store_total_count(), (int)before);
+    schedule_outputs();
+}
+
+// Drop what was restored at boot for bots that never came back, instead of
+// showing someone in voice indefinitely
+static void restore_expire(void) {
+    // Bots whose snapshot is arriving right now replace their guilds when
+    // it commits, dropping them here would throw that snapshot away
+    uint32_t absent = restored_sources & ~snapshot_sources;
+    if (!absent) return;
+
+    bool none_back = absent == (1u << bot_count) - 1;
+    ESP_LOGW(TAG, "No snapshot within %d s of boot, dropping restored voice state",
+             VOICE_RESTORE_MAX_MS / 1000);
+
+    // A rebuild in progress keeps going without these guilds
+    bool pending = voice_store_snapshot_pending();
+    for (int source = 0; source < bot_count; source++) {
+        if (absent & (1u << source)) voice_store_snapshot_begin(source);
     }
+    if (!pending) voice_store_snapshot_commit();
+    restored_sources &= ~absent;
+
+    dirty_all_channels = true;
+    apply_outputs();
+    // With no bot connected the state is as unknown as right after boot
+    if (none_back) led_animation_set(BOOT_ANIMATION);
 }
 
-// Event handler
+static void restore_timer_callback(void* arg) {
+    xTaskNotify(voice_task_handle, VOICE_NOTIFY_RESTORE, eSetBits);
+}
+
+// Drains the delta queue in batches and updates the outputs once per batch
+static void voice_task(void* arg) {
+    while (1) {
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+
+        if (bits & VOICE_NOTIFY_DELTAS) {
+            voice_delta_t delta;
+            int applied = 0;
+            int changed = 0;
+            for (int source = 0; source < bot_count; source++) {
+                voice_queue_t* queue = &voice_queues[source];
+                while (voice_queue_pop(queue, &delta)) {
+                    if (delta.flags & VOICE_DELTA_SESSION) {
+                        snapshot_start(source);
+                    } else if (voice_store_snapshot_pending()) {
+                        // Every user shows up as a join here, only the result counts
+                        if (voice_store_update(source, delta.guild_id, delta.user_id, delta.channel_id) == VOICE_STORE_FULL) {
+                            ESP_LOGE(TAG, "Voice state table full, ignoring user %llu", (unsigned long long)delta.user_id);
+                        }
+                        applied++;
+                    } else {
+                        if (apply_voice_delta(source, &delta)) {
+                            if (!latency_pending) {
+                                latency_start_us = delta.stamp_us;
+                                latency_pending = true;
+                            }
+                            changed++;
+                        }
+                        applied++;
+                    }
+                }
+
+                uint32_t dropped = voice_queue_take_dropped(queue);
+                if (dropped) {
+                    metrics_counter_add(&events_dropped, dropped);
+                    ESP_LOGW(TAG, "Voice delta queue of bot %d overflowed, dropped %u updates", source, (unsigned)dropped);
+                }
+            }
+            metrics_counter_add(&events_processed, applied);
+            if (voice_store_snapshot_pending()) {
+                if (applied) snapshot_extend();
+            } else if (changed) {
+                schedule_outputs();
+            }
+        }
+
+        if ((bits & VOICE_NOTIFY_SNAPSHOT) && voice_store_snapshot_pending()) {
+            snapshot_finish();
+        }
+
+        if (bits & VOICE_NOTIFY_OUTPUT) {
+            apply_outputs();
+        }
+
+        if (bits & VOICE_NOTIFY_RESTORE) {
+            restore_expire();
+        }
+    }
+}
+
+static void voice_task_start(void) {
+    for (int i = 0; i < DISCORD_MAX_BOTS; i++) {
+        voice_queue_init(&voice_queues[i]);
+    }
+    metrics_register_counter(&events_processed);
+    metrics_register_counter(&events_dropped);
+    metrics_register_counter(&events_filtered);
+    metrics_register_histogram(&event_latency);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = output_timer_callback,
+        .name = "voice_output",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &output_timer));
+
+    const esp_timer_create_args_t snapshot_timer_args = {
+        .callback = snapshot_timer_callback,
+        .name = "voice_snapshot",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&snapshot_timer_args, &snapshot_timer));
+
+    const esp_timer_create_args_t restore_timer_args = {
+        .callback = restore_timer_callback,
+        .name = "voice_restore",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&restore_timer_args, &restore_timer));
+
+    voice_task_handle = xTaskCreateStaticPinnedToCore(voice_task, "voice_state", VOICE_TASK_STACK, NULL,
+                                                      CONFIG_VOICE_TASK_PRIORITY, voice_task_stack, &voice_task_buf,
+                                                      CONFIG_VOICE_TASK_CORE_ID < 0 ? tskNO_AFFINITY : CONFIG_VOICE_TASK_CORE_ID);
+}
+
+// Event handler, runs on the esp-discord task of the bot given as
+// handler_arg, so it only queues work
 static void bot_event_handler(void* handler_arg, esp_event_base_t base, int32_t event_id, void* event_data) {
     discord_event_data_t* data = (discord_event_data_t*)event_data;
+    int source = (int)(intptr_t)handler_arg;
+    voice_queue_t* queue = &voice_queues[source];
 
     switch (event_id) {
         case DISCORD_EVENT_CONNECTED: {
             discord_session_t* session = (discord_session_t*)data->ptr;
-            ESP_LOGI(TAG, "Bot %s#%s connected",
+            ESP_LOGI(TAG, "Bot %d (%s#%s) connected", source,
                      session->user->username,
                      session->user->discriminator);
+
+            // Queued in order with the deltas, so the snapshot that follows
+            // lands in the fresh table
+            voice_delta_t marker = { .flags = VOICE_DELTA_SESSION };
+            voice_queue_push(queue, &marker);
+            xTaskNotify(voice_task_handle, VOICE_NOTIFY_DELTAS, eSetBits);
+
+            static bool boot_logged = false;
+            if (!boot_logged) {
+                boot_stage_end(BOOT_DISCORD);
+                boot_log_timing();
+                boot_logged = true;
+            }
         } break;
 
         case DISCORD_EVENT_VOICE_STATE_UPDATED: {
             discord_voice_state_t* vstate = (discord_voice_state_t*)data->ptr;
 
-            ESP_LOGI(TAG, "voice_state (user_id=%s, channel_id=%s, mute=%d, self_mute=%d, deaf=%d, self_deaf=%d)",
-                     vstate->user_id,
-                     vstate->channel_id ? vstate->channel_id : "NULL",
-                     vstate->mute,
-                     vstate->self_mute,
-                     vstate->deaf,
-                     vstate->self_deaf);
-
-            // Update the user's voice state
-            update_user_voice_state(vstate->user_id, vstate->channel_id);
-
-            // Example action: Toggle LED based on user count
-            if (voice_channel_user_count > 0) {
-                led_animation_set(LED_ANIM_SOLID);
-                gpio_set_level(LED_GPIO, 1);  // Turn LED on
-            } else {
-                led_animation_set(LED_ANIM_OFF);
-                gpio_set_level(LED_GPIO, 0);  // Turn LED off
+            // Checked before anything is parsed or queued
+            if (!guild_allowed(vstate->guild_id)) {
+                metrics_counter_add(&events_filtered, 1);
+                break;
             }
+
+            voice_delta_t delta = {
+                .guild_id = voice_store_parse_snowflake(vstate->guild_id),
+                .user_id = voice_store_parse_snowflake(vstate->user_id),
+                .channel_id = voice_store_parse_snowflake(vstate->channel_id),
+                .flags = (vstate->mute ? VOICE_DELTA_MUTE : 0) |
+                         (vstate->self_mute ? VOICE_DELTA_SELF_MUTE : 0) |
+                         (vstate->deaf ? VOICE_DELTA_DEAF : 0) |
+                         (vstate->self_deaf ? VOICE_DELTA_SELF_DEAF : 0),
+                .stamp_us = (uint32_t)esp_timer_get_time(),
+            };
+
+            // A full queue is reported by the voice task, not here
+            voice_queue_push(queue, &delta);
+            xTaskNotify(voice_task_handle, VOICE_NOTIFY_DELTAS, eSetBits);
         } break;
 
         case DISCORD_EVENT_DISCONNECTED:
-            ESP_LOGW(TAG, "Bot logged out");
+            ESP_LOGW(TAG, "Bot %d logged out", source);
             break;
 
         default:
@@ -154,40 +610,148 @@ static void bot_event_handler(void* handler_arg, esp_event_base_t base, int32_t
     }
 }
 
-// Free linked list memory
-void free_voice_states() {
-    user_voice_state_t* current = voice_states_head;
-    while (current) {
-        user_voice_state_t* next = current->next;
-        free(current);
-        current = next;
-    }
-}
-
 
 // ======= WIFI STA/AP LOGIC =======
+#define WIFI_CACHE_NAMESPACE "wifi_cache"
+#define WIFI_CACHE_KEY "ap"
+
+// Last AP we associated with, lets a reconnect skip the channel scan
+typedef struct {
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_ap_cache_t;
+
 static bool sta_connected = false;
 static httpd_handle_t server = NULL;
+static wifi_ap_cache_t ap_cache;
+static bool ap_cache_valid = false;
+static bool sta_fast_connect = false; // STA config currently pins BSSID/channel
+static bool fallback_ap = false;      // AP running next to the retrying STA
+static int sta_retry_count = 0;
+static esp_timer_handle_t sta_retry_timer = NULL;
+
+static void ap_cache_load(const char* ssid) {
+    nvs_handle_t handle;
+    ap_cache_valid = false;
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return;
+
+    size_t len = sizeof(ap_cache);
+    if (nvs_get_blob(handle, WIFI_CACHE_KEY, &ap_cache, &len) == ESP_OK && len == sizeof(ap_cache)) {
+        // Only trust it for the network it was recorded on
+        ap_cache.ssid[sizeof(ap_cache.ssid) - 1] = '\0';
+        ap_cache_valid = strcmp(ap_cache.ssid, ssid) == 0 && ap_cache.channel != 0;
+    }
+    nvs_close(handle);
+}
+
+static void ap_cache_store(const wifi_event_sta_connected_t* event) {
+    wifi_ap_cache_t entry = {0};
+    memcpy(entry.ssid, event->ssid, MIN(event->ssid_len, sizeof(entry.ssid) - 1));
+    memcpy(entry.bssid, event->bssid, sizeof(entry.bssid));
+    entry.channel = event->channel;
+
+    // Roaming between the same APs should not wear the flash
+    if (ap_cache_valid && memcmp(&entry, &ap_cache, sizeof(entry)) == 0) return;
+
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
+    if (nvs_set_blob(handle, WIFI_CACHE_KEY, &entry, sizeof(entry)) == ESP_OK &&
+        nvs_commit(handle) == ESP_OK) {
+        ap_cache = entry;
+        ap_cache_valid = true;
+        ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %u", MAC2STR(entry.bssid), entry.channel);
+    }
+    nvs_close(handle);
+}
+
+// Pin the STA to the cached AP, or go back to a full scan
+static void sta_set_fast_connect(bool enable) {
+    wifi_config_t sta_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &sta_config) != ESP_OK) return;
+
+    sta_fast_connect = enable && ap_cache_valid;
+    if (sta_fast_connect) {
+        memcpy(sta_config.sta.bssid, ap_cache.bssid, sizeof(sta_config.sta.bssid));
+        sta_config.sta.bssid_set = true;
+        sta_config.sta.channel = ap_cache.channel;
+        sta_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        sta_config.sta.bssid_set = false;
+        sta_config.sta.channel = 0;
+        sta_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+}
+
+static void sta_retry_timer_callback(void* arg) {
+    esp_wifi_connect();
+}
+
+// Exponential backoff with jitter, so a fleet that lost the same router
+// does not reconnect in lockstep
+static void sta_schedule_retry(void) {
+    int shift = MIN(sta_retry_count, 16);
+    uint32_t delay_ms = MIN((uint32_t)CONFIG_WIFI_RETRY_BASE_MS << shift, (uint32_t)CONFIG_WIFI_RETRY_MAX_MS);
+    delay_ms = delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+
+    ESP_LOGI(TAG, "STA retry %d in %u ms%s", sta_retry_count + 1, (unsigned)delay_ms,
+             sta_fast_connect ? " (cached AP)" : "");
+    esp_timer_stop(sta_retry_timer);
+    esp_timer_start_once(sta_retry_timer, (uint64_t)delay_ms * 1000);
+}
+
+static void set_ap_config(void) {
+    wifi_config_t ap_config = {0};
+    strncpy((char*)ap_config.ap.ssid, CONFIG_AP_SSID, sizeof(ap_config.ap.ssid));
+    strncpy((char*)ap_config.ap.password, CONFIG_AP_PASSWORD, sizeof(ap_config.ap.password));
+    ap_config.ap.max_connection = CONFIG_AP_MAX_CONN;
+    ap_config.ap.authmode = WIFI_AUTH_WPA2_PSK;
+
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
+}
+
+// Bring up the portal AP without giving up on the saved network
+static void start_fallback_ap(void) {
+    ESP_LOGW(TAG, "STA failed %d times, starting AP '%s' while retrying", sta_retry_count, CONFIG_AP_SSID);
+    fallback_ap = true;
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+    set_ap_config();
+
+    if (!server) {
+        server = config_portal_start();
+    }
+}
 
 void wifi_event_handler(void* arg, esp_event_base_t event_base,
                         int32_t event_id, void* event_data) {
-    static int sta_retry_count = 0;
-
     if (event_base == WIFI_EVENT) {
         switch (event_id) {
             case WIFI_EVENT_STA_START:
                 esp_wifi_connect();
                 break;
+            case WIFI_EVENT_STA_CONNECTED:
+                ap_cache_store((wifi_event_sta_connected_t*) event_data);
+                break;
             case WIFI_EVENT_STA_DISCONNECTED:
-                if (sta_retry_count < CONFIG_MAX_STA_RETRIES) {
-                    ESP_LOGI(TAG, "STA disconnected, retrying...");
-                    esp_wifi_connect();
-                    sta_retry_count++;
-                } else {
-                    ESP_LOGI(TAG, "STA failed, fallback to AP");
+                if (sta_connected) {
+                    // Lost a working link, the AP is most likely still where it was
+                    ESP_LOGI(TAG, "STA disconnected, reconnecting...");
                     sta_connected = false;
-                    start_ap();
+                    sta_retry_count = 0;
+                    sta_set_fast_connect(true);
+                } else {
+                    if (sta_fast_connect) {
+                        // The cached AP is gone or moved to another channel
+                        ESP_LOGI(TAG, "Cached AP not found, using a full scan");
+                        sta_set_fast_connect(false);
+                    }
+                    sta_retry_count++;
+                    if (sta_retry_count == CONFIG_MAX_STA_RETRIES && !fallback_ap) {
+                        start_fallback_ap();
+                    }
                 }
+                sta_schedule_retry();
                 break;
             case WIFI_EVENT_AP_STACONNECTED:
                 ESP_LOGI(TAG, "Device connected to AP");
@@ -205,26 +769,31 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "Gateway=" IPSTR, IP2STR(&event->ip_info.gw));
 
         sta_connected = true;
+        sta_retry_count = 0;
+        if (boot_stage_end_us[BOOT_GOT_IP] == 0) {
+            boot_stage_end(BOOT_GOT_IP);
+        }
+        esp_timer_stop(sta_retry_timer);
+        if (fallback_ap) {
+            ESP_LOGI(TAG, "STA is back, stopping fallback AP");
+            fallback_ap = false;
+            esp_wifi_set_mode(WIFI_MODE_STA);
+        }
+        power_apply();
         connection_success_callback();
     }
 }
 
 
 void start_ap(void) {
-    if (server) config_portal_stop(server);
-
-    wifi_config_t ap_config = {0};
-    strncpy((char*)ap_config.ap.ssid, CONFIG_AP_SSID, sizeof(ap_config.ap.ssid));
-    strncpy((char*)ap_config.ap.password, CONFIG_AP_PASSWORD, sizeof(ap_config.ap.password));
-    ap_config.ap.max_connection = CONFIG_AP_MAX_CONN;
-    ap_config.ap.authmode = WIFI_AUTH_WPA2_PSK;
-
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
+    set_ap_config();
     ESP_ERROR_CHECK(esp_wifi_start());
 
     ESP_LOGI(TAG, "AP started: SSID='%s'", CONFIG_AP_SSID);
-    server = config_portal_start();
+    if (!server) {
+        server = config_portal_start();
+    }
 }
 
 
@@ -233,6 +802,30 @@ void start_sta(const char* ssid, const char* pass) {
     strncpy((char*)sta_config.sta.ssid, ssid, sizeof(sta_config.sta.ssid));
     strncpy((char*)sta_config.sta.password, pass, sizeof(sta_config.sta.password));
 
+    // Skip the scan if we know where the AP was last time
+    ap_cache_load(ssid);
+    sta_fast_connect = ap_cache_valid;
+    if (sta_fast_connect) {
+        memcpy(sta_config.sta.bssid, ap_cache.bssid, sizeof(sta_config.sta.bssid));
+        sta_config.sta.bssid_set = true;
+        sta_config.sta.channel = ap_cache.channel;
+        sta_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        sta_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+#if CONFIG_POWER_SAVE_IDLE
+    // Beacons slept through in WIFI_PS_MAX_MODEM
+    sta_config.sta.listen_interval = CONFIG_POWER_WIFI_LISTEN_INTERVAL;
+#endif
+
+    if (!sta_retry_timer) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = sta_retry_timer_callback,
+            .name = "sta_retry",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &sta_retry_timer));
+    }
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
     ESP_ERROR_CHECK(esp_wifi_start());
@@ -241,7 +834,12 @@ void start_sta(const char* ssid, const char* pass) {
     esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
     ESP_ERROR_CHECK(esp_netif_set_hostname(netif, CONFIG_DEVICE_NAME));
 
-    ESP_LOGI(TAG, "STA started. Trying to connect to SSID='%s'", ssid);
+    if (sta_fast_connect) {
+        ESP_LOGI(TAG, "STA started. Trying to connect to SSID='%s' via cached AP " MACSTR " (channel %u)",
+                 ssid, MAC2STR(ap_cache.bssid), ap_cache.channel);
+    } else {
+        ESP_LOGI(TAG, "STA started. Trying to connect to SSID='%s'", ssid);
+    }
 }
 
 
@@ -263,82 +861,338 @@ static void init_mdns(void)
 }
 
 
+// ======= POWER =======
+#if CONFIG_POWER_SAVE_IDLE
+
+static bool power_idle = false;
+
+// CPU and radio side of the idle mode, applied again when the STA connects
+static void power_apply(void) {
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = power_idle ? CONFIG_POWER_IDLE_MIN_FREQ_MHZ : CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .light_sleep_enable = power_idle,
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Power management not applied: %s", esp_err_to_name(err));
+    }
+#endif
+
+    // The gateway websocket stays up in either mode, only its latency
+    // changes. The fallback AP has to keep answering clients.
+    if (sta_connected && !fallback_ap) {
+        esp_wifi_set_ps(power_idle ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+    }
+}
+
+// Nobody in voice: dark unpowered strip, light sleep and max modem sleep
+static void power_set_idle(bool idle) {
+    if (idle == power_idle) return;
+    power_idle = idle;
+    ESP_LOGI(TAG, "%s idle power mode", idle ? "Entering" : "Leaving");
+
+    // The LED task finishes the fade to off before it blanks the strip,
+    // and the strip is powered up again with the CPU at full speed
+    if (idle) {
+        led_animation_suspend();
+        power_apply();
+    } else {
+        power_apply();
+        led_animation_resume();
+    }
+}
+
+#else
+
+static void power_apply(void) {}
+static void power_set_idle(bool idle) {}
+
+#endif
+
+
 // ======= SUCCESS CALLBACK =======
 void connection_success_callback(void) {
     ESP_LOGI(TAG, "STA connected successfully! Callback triggered.");
 
-    init_mdns();
-
-    gpio_reset_pin(LED_GPIO);
-    gpio_set_direction(LED_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_level(LED_GPIO, 0);
-
     if (!server) {
         server = config_portal_start();
     }
 
-    discord_config_t cfg = {
-       .intents = DISCORD_INTENT_GUILD_VOICE_STATES
+    // Runs again after every reconnect, the bots are created once and
+    // reconnect on their own
+    if (bots[0]) return;
+
+    boot_stage_begin(BOOT_DISCORD);
+    for (int i = 0; i < bot_count; i++) {
+        // GUILDS brings the GUILD_CREATE snapshots the store is rebuilt from
+        discord_config_t cfg = {
+           .token = bot_tokens[i][0] ? bot_tokens[i] : NULL,
+           .intents = DISCORD_INTENT_GUILDS | DISCORD_INTENT_GUILD_VOICE_STATES
+        };
+
+        bots[i] = discord_create(&cfg);
+        ESP_ERROR_CHECK(discord_register_events(bots[i], DISCORD_EVENT_ANY, bot_event_handler, (void*)(intptr_t)i));
+        ESP_ERROR_CHECK(discord_login(bots[i]));
+    }
+}
+
+// Tokens from DISCORD_BOT_TOKENS, or a single bot with the token
+// esp-discord was configured with
+static void load_bot_tokens(void) {
+    char tokens[] = CONFIG_DISCORD_BOT_TOKENS;
+    char* save = NULL;
+
+    bot_count = 0;
+    for (char* tok = strtok_r(tokens, "; ", &save); tok; tok = strtok_r(NULL, "; ", &save)) {
+        if (bot_count == DISCORD_MAX_BOTS || strlen(tok) >= DISCORD_TOKEN_MAX) {
+            ESP_LOGW(TAG, "Ignoring bot token %d", bot_count + 1);
+            continue;
+        }
+        strcpy(bot_tokens[bot_count++], tok);
+    }
+    if (bot_count == 0) {
+        bot_tokens[0][0] = '\0';
+        bot_count = 1;
+    }
+    ESP_LOGI(TAG, "%d Discord bot%s configured", bot_count, bot_count == 1 ? "" : "s");
+}
+
+
+// ======= LED STRIP =======
+// Only the first strip gets the DMA channel, the others use the RMT
+// channel's own memory
+// Returns NULL if the driver rejects the strip, a bad saved strip list
+// must not keep the device from booting into the portal
+static led_strip_handle_t create_led_strip(int gpio, size_t led_count, bool primary) {
+    led_strip_handle_t strip = NULL;
+    esp_err_t err;
+
+    led_strip_config_t strip_config = {
+        .strip_gpio_num = gpio,
+        .max_leds = led_count,
+        .led_model = LED_MODEL_WS2812,
+        .color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB,
+        .flags.invert_out = false,
+    };
+
+#if CONFIG_LED_STRIP_BACKEND_SPI
+    led_strip_spi_config_t spi_config = {
+        .clk_src = SPI_CLK_SRC_DEFAULT,
+        .spi_bus = SPI2_HOST,
+        .flags.with_dma = true,
     };
 
-    bot = discord_create(&cfg);
-    ESP_ERROR_CHECK(discord_register_events(bot, DISCORD_EVENT_ANY, bot_event_handler, NULL));
-    ESP_ERROR_CHECK(discord_login(bot));
+    err = led_strip_new_spi_device(&strip_config, &spi_config, &strip);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "LED strip on GPIO %d failed: %s", gpio, esp_err_to_name(err));
+        return NULL;
+    }
+    ESP_LOGI(TAG, "LED strip on SPI2 (DMA), GPIO %d, %d LEDs", gpio, (int)led_count);
+#else
+    led_strip_rmt_config_t rmt_config = {
+        .clk_src = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz = 10 * 1000 * 1000,
+        .mem_block_symbols = primary ? CONFIG_LED_STRIP_RMT_MEM_BLOCK_SYMBOLS : 0, // 0 picks the channel size
+#if CONFIG_LED_STRIP_RMT_DMA
+        .flags.with_dma = primary,
+#else
+        .flags.with_dma = false,
+#endif
+    };
+
+    err = led_strip_new_rmt_device(&strip_config, &rmt_config, &strip);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "LED strip on GPIO %d failed: %s", gpio, esp_err_to_name(err));
+        return NULL;
+    }
+    ESP_LOGI(TAG, "LED strip on RMT (%s), GPIO %d, %d LEDs",
+             rmt_config.flags.with_dma ? "DMA" : "no DMA", gpio, (int)led_count);
+#endif
+
+    return strip;
+}
+
+// Parse "gpio:count;gpio:count", returns the number of strips
+// Strips are only kept on output-capable pins, and cut to what is left of
+// the framebuffer so the driver never allocates for LEDs nobody draws
+static size_t parse_strip_list(const char* list, int* gpios, size_t* lengths, size_t max_strips) {
+    size_t n = 0;
+    size_t total = 0;
+    const char* p = list;
+
+#if CONFIG_LED_STRIP_BACKEND_SPI
+    // Every strip would claim SPI2_HOST
+    max_strips = 1;
+#endif
+
+    while (*p && n < max_strips) {
+        char* end;
+        long gpio = strtol(p, &end, 10);
+        if (end == p || *end != ':' || gpio < 0 || gpio >= GPIO_NUM_MAX ||
+            !GPIO_IS_VALID_OUTPUT_GPIO(gpio)) break;
+        p = end + 1;
+        long count = strtol(p, &end, 10);
+        if (end == p || count <= 0) break;
+
+        if (total == CONFIG_LED_STRIP_LED_COUNT) {
+            ESP_LOGW(TAG, "Framebuffer full, ignoring strip on GPIO %ld", gpio);
+        } else {
+            size_t room = CONFIG_LED_STRIP_LED_COUNT - total;
+            gpios[n] = (int)gpio;
+            lengths[n] = MIN((size_t)count, room);
+            total += lengths[n];
+            n++;
+        }
+        p = end;
+        if (*p == ';') p++;
+        else if (*p) break;
+    }
+    if (*p) {
+        ESP_LOGW(TAG, "Ignoring strip list after '%s'", p);
+    }
+    return n;
+}
+
+// Create every configured strip, returns how many were created
+static size_t create_led_strips(led_strip_handle_t* strips, size_t* lengths) {
+    char list[64] = {0};
+    if (load_setting("strips", list, sizeof(list)) != ESP_OK) {
+        strncpy(list, CONFIG_LED_STRIP_LIST, sizeof(list) - 1);
+    }
+
+    int gpios[LED_FRAMEBUFFER_MAX_STRIPS];
+    size_t count = parse_strip_list(list, gpios, lengths, LED_FRAMEBUFFER_MAX_STRIPS);
+
+    // Strips the driver rejects are skipped, the rest close up
+    size_t created = 0;
+    for (size_t i = 0; i < count; i++) {
+        led_strip_handle_t strip = create_led_strip(gpios[i], lengths[i], created == 0);
+        if (!strip) continue;
+        strips[created] = strip;
+        lengths[created] = lengths[i];
+        created++;
+    }
+    if (created == 0) {
+        if (list[0]) ESP_LOGW(TAG, "No usable strip in '%s', using GPIO %d", list, CONFIG_LED_STRIP_GPIO);
+        strips[0] = create_led_strip(CONFIG_LED_STRIP_GPIO, CONFIG_LED_STRIP_LED_COUNT, true);
+        lengths[0] = CONFIG_LED_STRIP_LED_COUNT;
+        created = strips[0] ? 1 : 0;
+    }
+    return created;
 }
 
 
 // ======= MAIN =======
+static TaskHandle_t boot_main_task = NULL;
+
+// Static as well, the stack stays reserved after the task exits instead of
+// leaving a hole between the Wi-Fi driver's buffers
+static StackType_t boot_services_stack[BOOT_SERVICES_STACK];
+static StaticTask_t boot_services_buf;
+
+// RTC memory only survives resets that keep the chip powered, a copy from
+// before a power cycle would be stale or garbage
+static bool warm_boot(void) {
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Brings up the network services while app_main initializes Wi-Fi
+static void boot_services_task(void* arg) {
+    boot_stage_begin(BOOT_SERVICES);
+    init_mdns();
+    server = config_portal_start();
+    boot_stage_end(BOOT_SERVICES);
+
+    xTaskNotifyGive(boot_main_task);
+    vTaskDelete(NULL);
+}
+
 void app_main(void) {
     ESP_LOGI(TAG, "Starting Wi-Fi captive portal example");
 
-    ESP_ERROR_CHECK(nvs_flash_init());
+    // Settings first, the strip needs its colour and brightness
+    boot_stage_begin(BOOT_SETTINGS);
+    config_portal_init();
+    boot_stage_end(BOOT_SETTINGS);
+
+#if CONFIG_BENCHMARK_ENABLE
+    // Before the LED and voice tasks exist, so nothing competes for the CPU
+    benchmark_run();
+#endif
+
+    // Strip next, so there is something to look at while we connect
+    boot_stage_begin(BOOT_LEDS);
+    gpio_reset_pin(LED_GPIO);
+    gpio_set_direction(LED_GPIO, GPIO_MODE_OUTPUT);
+    gpio_set_level(LED_GPIO, 0);
+
+    led_strip_handle_t strips[LED_FRAMEBUFFER_MAX_STRIPS];
+    size_t strip_lengths[LED_FRAMEBUFFER_MAX_STRIPS];
+    size_t strip_count = create_led_strips(strips, strip_lengths);
+    led_animation_init(strips, strip_lengths, strip_count);
+    led_animation_set(BOOT_ANIMATION);
+
+    voice_store_init();
+    load_guild_allow_list();
+    load_bot_tokens();
+
+    // Show the occupancy from before a soft reset right away, each bot's
+    // snapshot replaces its guilds once the bot is back
+    bool restored = warm_boot() && voice_store_restore(bot_count);
+    if (restored) {
+        ESP_LOGI(TAG, "Restored %d users in voice from RTC memory", (int)voice_store_total_count());
+        dirty_all_channels = true;
+        restored_sources = (1u << bot_count) - 1;
+        led_animation_set_level_source(voice_level, CONFIG_OCCUPANCY_FULL_USERS);
+    }
+    voice_task_start();
+    if (restored) {
+        xTaskNotify(voice_task_handle, VOICE_NOTIFY_OUTPUT, eSetBits);
+        esp_timer_start_once(restore_timer, (uint64_t)VOICE_RESTORE_MAX_MS * 1000);
+    }
+    boot_stage_end(BOOT_LEDS);
+
+    boot_stage_begin(BOOT_NETIF);
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     // Create default interfaces
     esp_netif_create_default_wifi_sta();
     esp_netif_create_default_wifi_ap();
+    boot_stage_end(BOOT_NETIF);
 
-    // Init settings
-    config_portal_init();
+    // mDNS and the portal only need the netifs, not a running Wi-Fi driver
+    boot_main_task = xTaskGetCurrentTaskHandle();
+    xTaskCreateStatic(boot_services_task, "boot_services", BOOT_SERVICES_STACK, NULL, 5,
+                      boot_services_stack, &boot_services_buf);
 
     // Initialize Wi-Fi once
+    boot_stage_begin(BOOT_WIFI_INIT);
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
     ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_FLASH));
 
-    // Initialize LED Strip
-
-    led_strip_handle_t strip;
-
-    led_strip_config_t strip_config = {
-        .strip_gpio_num = CONFIG_LED_STRIP_GPIO,
-        .max_leds = CONFIG_LED_STRIP_LED_COUNT,
-        .led_model = LED_MODEL_WS2812,
-        .color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB,
-        .flags.invert_out = false,
-    };
-
-    led_strip_rmt_config_t rmt_config = {
-        .clk_src = RMT_CLK_SRC_DEFAULT,
-        .resolution_hz = 10 * 1000 * 1000,
-        .mem_block_symbols = 64,
-        .flags.with_dma = false,
-    };
-
-    ESP_ERROR_CHECK(
-        led_strip_new_rmt_device(&strip_config, &rmt_config, &strip)
-    );
-
-    led_animation_init(strip);
-    led_animation_set(LED_ANIM_SOLID);
-
     // Register event handlers
     esp_event_handler_instance_t instance_any_id;
     esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
                                         &wifi_event_handler, NULL, &instance_any_id);
     esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
                                         &wifi_event_handler, NULL, &instance_any_id);
+    boot_stage_end(BOOT_WIFI_INIT);
+
+    // boot_services_task writes `server`, which the Wi-Fi code below checks before starting the portal
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
     // Decide STA vs AP
     char ssid[32] = {0};
@@ -349,12 +1203,16 @@ void app_main(void) {
     bool have_pass =
         load_setting("pass", pass, sizeof(pass)) == ESP_OK;
 
+    boot_stage_begin(BOOT_WIFI_START);
     if (have_ssid && have_pass) {
         ESP_LOGI(TAG, "Found saved credentials, starting STA...");
         start_sta(ssid, pass);
+        boot_stage_begin(BOOT_GOT_IP);
     } else {
         ESP_LOGI(TAG, "No saved credentials, starting AP...");
         start_ap();
     }
+    boot_stage_end(BOOT_WIFI_START);
 
+    boot_log_timing();
 }